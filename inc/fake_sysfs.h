@@ -0,0 +1,75 @@
+/*
+ * © 2024 Proxeet Limited
+ *
+ * The poed packet is licensed under the GNU Lesser General Public License version 3,
+ * published by the Free Software Foundation.
+ *
+ * You may use, distribute, and modify this code under the terms of the LGPLv3.
+ *
+ * The project is distributed WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU Lesser General Public License version 3 for more details.
+ *
+ * Author: Aleksey Vasilenko (a.vasilenko@proxeet.com)
+ */
+
+#ifndef POED_FAKE_SYSFS_H
+#define POED_FAKE_SYSFS_H
+
+#include <cstdint>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+#include "poe_simulator.h"
+
+struct FakeSysfsOptions {
+    std::string root;
+    size_t controllers = 2;
+    size_t ports = 4;
+    uint32_t read_latency_us = 0;     /* delay before port_info/port_status content is served */
+    double read_error_rate = 0.0;     /* share of reads served truncated or corrupted */
+    double write_drop_rate = 0.0;     /* share of power/mode writes silently ignored */
+    int fault_controller = -1;        /* the only controller with the latency and faults above, -1 for all */
+    uint32_t seed = 1;
+};
+
+/* Controller directory with the driver files made as FIFOs served by the helper threads,
+ * so every read and write of the daemon goes through the real file I/O path
+ */
+class FakeSysfsController {
+private:
+    struct Port {
+        PoePortSim sim;
+        std::string mode;
+        std::string info_line;
+        std::string status_line;
+    };
+
+    std::string path;
+    std::vector<Port> ports;
+    const FakeSysfsOptions& options;
+    std::mutex lock;
+    std::mt19937 rng;
+    bool faulty;
+
+    bool injectFault(double rate);
+    std::string renderPortInfo();
+    std::string renderPortStatus();
+    void applyWrite(const std::string& file, const std::string& content);
+    void serveRead(const std::string& file);
+    void serveWrite(const std::string& file);
+
+public:
+    FakeSysfsController(std::string path, size_t index, size_t ports_num, const FakeSysfsOptions& options);
+
+    const std::string& getPath() const { return path; }
+    bool create();
+    void start();
+};
+
+std::string getFakeSysfsUciConfig(const FakeSysfsOptions& options,
+                                  const std::vector<FakeSysfsController*>& controllers);
+
+#endif //POED_FAKE_SYSFS_H
@@ -17,9 +17,176 @@
 #ifndef ROUTER_POED_LOGS_H
 #define ROUTER_POED_LOGS_H
 
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
 #include <syslog.h>
+#include "stats.h"
 
 int get_syslog_level(const std::string& level);
 void initialize_logging(const char* log_name, int log_level);
 
+/* Records of the asynchronous log, a power of two */
+#define POE_LOG_QUEUE_SIZE      256
+#define POE_LOG_MAX_ARGS        8
+/* Space for the string arguments of one record, longer ones are cut */
+#define POE_LOG_TEXT_SIZE       160
+#define POE_LOG_DRAIN_PERIOD_US 10000
+/* A repeated message is reported at the latest after this time */
+#define POE_LOG_REPEAT_FLUSH_US (5 * 1000000ull)
+
+/* X(value, name, messages per second, burst) */
+#define POE_LOG_CATEGORIES(X) \
+    X(GENERAL,  "general",  50, 100) \
+    X(BUDGET,   "budget",   20, 50) \
+    X(PORT,     "port",     20, 50) \
+    X(HARDWARE, "hardware", 5,  20) \
+    X(SOCKET,   "socket",   10, 20) \
+    X(STATE,    "state",    5,  20)
+
+#define POE_LOG_CATEGORY_VALUE(value, ...) value,
+
+enum class LogCategory {
+    POE_LOG_CATEGORIES(POE_LOG_CATEGORY_VALUE)
+    COUNT
+};
+
+enum LogArgType : uint8_t {
+    LOG_ARG_INT,
+    LOG_ARG_UINT,
+    LOG_ARG_DOUBLE,
+    LOG_ARG_STR
+};
+
+/* Message captured by the caller without formatting: the format literal and the raw arguments,
+ * string arguments are copied into the text of the record
+ */
+struct LogRecord {
+    const char* fmt;
+    uint8_t category;
+    uint8_t priority;
+    uint8_t argc;
+    uint8_t text_used;
+    uint8_t types[POE_LOG_MAX_ARGS];
+    uint64_t args[POE_LOG_MAX_ARGS];    /* value or offset of the string in the text */
+    char text[POE_LOG_TEXT_SIZE];
+};
+
+/* Log front-end of the daemon. Callers only capture the message into a bounded lock-free queue
+ * and never wait, the drain thread formats the messages, collapses repeats, applies the rate limits
+ * of the categories and writes to syslog. Without the drain thread the messages are written at once
+ */
+class PoeLogger {
+private:
+    struct Cell {
+        std::atomic<size_t> seq;
+        LogRecord record;
+    };
+
+    struct TokenBucket {
+        double tokens;
+        uint64_t refill_us;
+    };
+
+    Cell cells[POE_LOG_QUEUE_SIZE];
+    std::atomic<size_t> enqueue_pos{0};
+    size_t dequeue_pos = 0;
+    std::atomic<int> level{LOG_INFO};
+    std::atomic<bool> running{false};
+    std::atomic<bool> stopping{false};
+    std::thread drain_thread;
+
+    /* State of the output, guarded by the lock */
+    std::mutex output_lock;
+    TokenBucket buckets[(size_t)LogCategory::COUNT];
+    uint64_t rate_limited[(size_t)LogCategory::COUNT] = {};
+    std::string last_text;
+    int last_priority = -1;
+    uint64_t repeats = 0;
+    uint64_t repeat_start_us = 0;
+
+    static void addArg(LogRecord& record, LogArgType type, uint64_t value);
+    static void addStringArg(LogRecord& record, const char* value);
+
+    template<typename T>
+    static typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+    captureArg(LogRecord& record, T value) { addArg(record, LOG_ARG_INT, (uint64_t)(int64_t)value); }
+
+    template<typename T>
+    static typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value>::type
+    captureArg(LogRecord& record, T value) { addArg(record, LOG_ARG_UINT, (uint64_t)value); }
+
+    template<typename T>
+    static typename std::enable_if<std::is_floating_point<T>::value>::type
+    captureArg(LogRecord& record, T value);
+
+    static void captureArg(LogRecord& record, const char* value) { addStringArg(record, value); }
+
+    bool push(const LogRecord& record);
+    bool pop(LogRecord& record);
+    void output(const LogRecord& record, uint64_t now_us);
+    void flushRepeats();
+    void flushRateLimited(uint64_t now_us);
+    void drain();
+
+public:
+    StatCounter written;
+    StatCounter dropped;        /* the queue was full */
+    StatCounter collapsed;      /* repeats of the previous message */
+    StatCounter rate_limited_total;
+
+    PoeLogger();
+    ~PoeLogger();
+
+    bool enabled(int priority) const { return priority <= level.load(std::memory_order_relaxed); }
+    void setLevel(int log_level) { level.store(log_level, std::memory_order_relaxed); }
+    void start();
+    void stop();
+    void submit(const LogRecord& record);
+
+    template<typename... Args>
+    void log(LogCategory category, int priority, const char* fmt, Args... args) {
+        LogRecord record;
+        record.fmt = fmt;
+        record.category = (uint8_t)category;
+        record.priority = priority;
+        record.argc = 0;
+        record.text_used = 0;
+        int expand[] = {0, (captureArg(record, args), 0)...};
+        (void)expand;
+        submit(record);
+    }
+};
+
+template<typename T>
+typename std::enable_if<std::is_floating_point<T>::value>::type
+PoeLogger::captureArg(LogRecord& record, T value) {
+    double d = value;
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    addArg(record, LOG_ARG_DOUBLE, bits);
+}
+
+extern PoeLogger poe_logger;
+
+const char* logCategoryToString(LogCategory category);
+
+/* Log through the asynchronous front-end, disabled priorities cost one comparison and the arguments
+ * aren't evaluated, the dead printf lets the compiler check the format against the arguments
+ */
+#define POE_LOG(category, priority, ...) \
+    do { \
+        if (poe_logger.enabled(priority)) { \
+            if (false) { \
+                printf(__VA_ARGS__); \
+            } \
+            poe_logger.log(LogCategory::category, priority, __VA_ARGS__); \
+        } \
+    } while (0)
+
 #endif //ROUTER_POED_LOGS_H
@@ -17,14 +17,74 @@
 #ifndef POED_MAIN_UTILS_H
 #define POED_MAIN_UTILS_H
 
+#include <unordered_map>
 #include "nlohmann/json.hpp"
 #include "utils.h"
 #include "poe_controller.h"
+#include "poe_schema.h"
 
+/* Longest request of the socket, a longer one closes the connection */
+#define POE_SOCKET_REQUEST_MAX    (64 * 1024)
+/* Most requests of one batch */
+#define POE_SOCKET_BATCH_MAX      32
+/* Connections served at once, the next ones wait in the listen backlog */
+#define POE_SOCKET_CLIENTS_MAX    16
+/* A connection without a request or a reading client for the time is closed */
+#define POE_SOCKET_IDLE_TIMEOUT_MS    5000
+
+/* Port name to controller and port indexes */
+typedef unordered_map<string, pair<size_t, size_t>> PortNameIndex;
+
+/* Fields selected for the response */
+struct FieldsProjection {
+    vector<PoePortField> port_fields;
+    bool total_budget = false;
+    bool total_power = false;
+    bool health = false;
+    bool ports = false;
+};
+
+bool parseFieldsProjection(const vector<string>& fields, FieldsProjection& projection, string& error_msg);
+nlohmann::json getJsonFromPort(const PoeController& controller, size_t port, const FieldsProjection& projection);
+nlohmann::json getJsonFromController(const PoeController& controller, const FieldsProjection& projection);
+nlohmann::json getJsonFromControllers(vector<PoeController>& controllers, const FieldsProjection& projection);
 nlohmann::json getJsonFromControllers(vector<PoeController>& controllers);
+PortNameIndex buildPortNameIndex(const vector<PoeController>& controllers);
+nlohmann::json getJsonStats(const vector<PoeController>& controllers);
+
+enum class SocketLoadStatus {
+    OK = 0,
+    ERROR_RESPONSE,   /* valid response with non-empty error_msg */
+    CONNECT_ERROR,
+    IO_ERROR,
+    TIMEOUT,
+    TRUNCATED,        /* connection closed in the middle of the response */
+    INVALID_JSON,
+    COUNT
+};
+
+struct SocketLoadOptions {
+    string socket_path;
+    vector<string> messages;    /* sent in turn by every connection */
+    size_t connections = 1;
+    double duration_s = 10.0;
+    double rate = 0.0;          /* requests per second per connection, 0 is closed loop */
+    bool persistent = false;    /* keep the connection between the requests */
+    int timeout_ms = 2000;
+};
+
+struct SocketLoadResult {
+    uint64_t status_cnt[(int)SocketLoadStatus::COUNT] = {};
+    uint64_t bytes = 0;
+    double elapsed_s = 0.0;
+    vector<uint64_t> latencies_us;
+};
+
+SocketLoadResult runSocketLoad(const SocketLoadOptions& options);
+nlohmann::json getJsonFromSocketLoadResult(const SocketLoadResult& result);
 string getJsonFromControllersSer(vector<PoeController>& controllers);
 void handleUnixSocketServer(const std::string& socket_path, vector<PoeController>& controllers);
 int controlBudgets(vector<PoeController>& controllers);
-void controlBudgetsWithSleep(vector<PoeController>& controllers, int sleep_time_us);
+void controlBudgetsWithSleep(vector<PoeController>& controllers, int sleep_time_us, uint64_t duration_us = 0);
 
 #endif //POED_MAIN_UTILS_H
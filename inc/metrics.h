@@ -0,0 +1,51 @@
+/*
+ * © 2024 Proxeet Limited
+ *
+ * The poed packet is licensed under the GNU Lesser General Public License version 3,
+ * published by the Free Software Foundation.
+ *
+ * You may use, distribute, and modify this code under the terms of the LGPLv3.
+ *
+ * The project is distributed WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU Lesser General Public License version 3 for more details.
+ *
+ * Author: Aleksey Vasilenko (a.vasilenko@proxeet.com)
+ */
+
+#ifndef POED_METRICS_H
+#define POED_METRICS_H
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "poe_controller.h"
+#include "stats.h"
+
+#define OPENMETRICS_CONTENT_TYPE "application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+/* OpenMetrics text of the daemon, rendered by the control loop once per cycle.
+ * Both buffers keep their capacity, so rendering doesn't allocate in steady state
+ */
+class MetricsBuffer {
+private:
+    std::mutex lock;
+    string published;
+    string rendering;
+
+    void append(const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+    void appendFamily(const char* name, const char* type, const char* unit, const char* help);
+    void appendPortLabels(size_t contr_ind, const PoePort& port);
+
+public:
+    void render(const vector<PoeController>& controllers, const DaemonStats& stats);
+    string get();
+};
+
+extern MetricsBuffer poe_metrics;
+
+void handleMetricsHttpServer(int port);
+
+#endif //POED_METRICS_H
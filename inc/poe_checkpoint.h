@@ -0,0 +1,89 @@
+/*
+ * © 2024 Proxeet Limited
+ *
+ * The poed packet is licensed under the GNU Lesser General Public License version 3,
+ * published by the Free Software Foundation.
+ *
+ * You may use, distribute, and modify this code under the terms of the LGPLv3.
+ *
+ * The project is distributed WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU Lesser General Public License version 3 for more details.
+ *
+ * Author: Aleksey Vasilenko (a.vasilenko@proxeet.com)
+ */
+
+#ifndef POED_POE_CHECKPOINT_H
+#define POED_POE_CHECKPOINT_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "poe_controller.h"
+
+#define POE_CHECKPOINT_MAGIC      0x54534450u   /* "PDST" */
+#define POE_CHECKPOINT_VERSION    2
+/* Port of the entries with the energy of the whole controller */
+#define POE_CHECKPOINT_CONTROLLER 0xFFFF
+/* The energy counters change on every cycle, they are saved with this period of the daemon clock */
+#define POE_CHECKPOINT_ENERGY_PERIOD_US    (60 * 1000000ull)
+
+/* The file is the header and two slots of the same size. The slots are written in turn,
+ * so a write torn by a crash spoils only the slot being written and the other one keeps the previous state
+ */
+struct PoeCheckpointHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+    uint32_t capacity;      /* entries a slot can hold */
+    uint32_t slot_size;
+};
+
+struct PoeCheckpointSlot {
+    uint64_t seq;           /* the slot with the highest valid seq is the current one */
+    uint32_t crc;           /* CRC-32 of the slot with zero crc */
+    uint32_t count;
+    /* count of PoeCheckpointEntry follow */
+};
+
+struct PoeCheckpointEntry {
+    uint32_t name_hash;     /* of the port name or the controller path, the entry is dropped if it changed */
+    uint16_t controller;
+    uint16_t port;          /* POE_CHECKPOINT_CONTROLLER for the controller entry */
+    uint8_t flags;          /* POE_PORT_CHECKPOINTED flags of the port */
+    uint8_t reserved[7];
+    uint64_t energy_uj;
+};
+
+/* Budget decisions of the control loop and the energy counters kept in a memory mapped file across restarts */
+class PoeCheckpoint {
+private:
+    std::string path;
+    int fd = -1;
+    uint8_t* map = nullptr;
+    size_t map_size = 0;
+    uint64_t seq = 0;
+    uint64_t saved_gen = 0;
+    uint64_t saved_us = 0;
+    std::atomic<bool> dirty{false};     /* set by the other threads to save on the next cycle */
+
+    bool create(const std::vector<PoeController>& controllers, size_t capacity);
+    void writeSlot(const std::vector<PoeController>& controllers);
+
+public:
+    ~PoeCheckpoint();
+
+    bool open(const std::string& path, const std::vector<PoeController>& controllers);
+    bool save(const std::vector<PoeController>& controllers);
+    bool saveIfChanged(const std::vector<PoeController>& controllers, uint64_t now_us);
+    void markDirty();
+    void close();
+
+    static bool load(const std::string& path, std::vector<PoeController>& controllers);
+};
+
+extern PoeCheckpoint poe_checkpoint;
+
+#endif //POED_POE_CHECKPOINT_H
@@ -0,0 +1,62 @@
+/*
+ * © 2024 Proxeet Limited
+ *
+ * The poed packet is licensed under the GNU Lesser General Public License version 3,
+ * published by the Free Software Foundation.
+ *
+ * You may use, distribute, and modify this code under the terms of the LGPLv3.
+ *
+ * The project is distributed WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU Lesser General Public License version 3 for more details.
+ *
+ * Author: Aleksey Vasilenko (a.vasilenko@proxeet.com)
+ */
+
+#ifndef POED_POE_CLOCK_H
+#define POED_POE_CLOCK_H
+
+#include <atomic>
+#include <cstdint>
+
+/* Time source of the control loop and of the timestamps it produces,
+ * measurements of the daemon's own costs always use the real monotonicUs()
+ */
+class PoeClock {
+public:
+    virtual ~PoeClock() = default;
+
+    virtual uint64_t nowUs() = 0;          /* Monotonic time */
+    virtual uint64_t realtimeUs() = 0;     /* Wall clock time since the Unix epoch */
+    virtual void sleepUs(uint64_t us) = 0;
+    virtual bool isVirtual() const = 0;
+};
+
+class RealClock : public PoeClock {
+public:
+    uint64_t nowUs() override;
+    uint64_t realtimeUs() override;
+    void sleepUs(uint64_t us) override;
+    bool isVirtual() const override { return false; }
+};
+
+/* Time warp: sleeping only advances the time, so simulations run as fast as the CPU allows */
+class VirtualClock : public PoeClock {
+private:
+    uint64_t start_us;
+    uint64_t start_realtime_us;
+    std::atomic<uint64_t> elapsed_us;
+
+public:
+    VirtualClock();
+
+    uint64_t nowUs() override;
+    uint64_t realtimeUs() override;
+    void sleepUs(uint64_t us) override;
+    bool isVirtual() const override { return true; }
+};
+
+extern PoeClock* poe_clock;
+
+#endif //POED_POE_CLOCK_H
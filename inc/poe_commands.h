@@ -0,0 +1,146 @@
+/*
+ * © 2024 Proxeet Limited
+ *
+ * The poed packet is licensed under the GNU Lesser General Public License version 3,
+ * published by the Free Software Foundation.
+ *
+ * You may use, distribute, and modify this code under the terms of the LGPLv3.
+ *
+ * The project is distributed WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU Lesser General Public License version 3 for more details.
+ *
+ * Author: Aleksey Vasilenko (a.vasilenko@proxeet.com)
+ */
+
+
+#ifndef POED_POE_COMMANDS_H
+#define POED_POE_COMMANDS_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include "poe_controller.h"
+
+/* Commands queued at once, a power of two */
+#define POE_COMMANDS_CAPACITY     64
+/* Port of the commands concerning the whole controller, far above POE_CONTROLLER_PORTS_MAX */
+#define POE_COMMAND_NO_PORT       0xFFFFFFFFu
+/* Least time the socket waits for the control loop to apply a command, or all the commands of a batch,
+ * the daemon raises it to two monitoring periods
+ */
+#define POE_COMMAND_TIMEOUT_US    (2 * 1000000ull)
+
+/* X(value, name of the socket request) */
+#define POE_COMMAND_KINDS(X) \
+    X(SET_PORT_POWER, "set_port_power") \
+    X(SET_MODE,       "set_mode") \
+    X(SET_BUDGET,     "set_budget") \
+    X(SET_PRIORITY,   "set_priority")
+
+#define POE_COMMAND_KIND_VALUE(value, ...) value,
+
+enum class PoeCommandKind : uint8_t {
+    POE_COMMAND_KINDS(POE_COMMAND_KIND_VALUE)
+    COUNT
+};
+
+/* Runtime change of a port or a controller, value is 0/1 power, the PoeMode, the budget in W or the priority */
+struct PoeCommand {
+    uint64_t seq;
+    uint64_t submit_us;     /* monotonic */
+    double value;
+    uint32_t controller;
+    uint32_t port;
+    PoeCommandKind kind;
+};
+
+struct PoeCommandResult {
+    uint64_t seq;
+    uint64_t latency_us;    /* from the submit to the end of the apply */
+    const char* error;      /* static string, nullptr if the command is applied */
+};
+
+/* Lock-free ring of one producer thread and one consumer thread */
+template<typename T, size_t N>
+class SpscQueue {
+private:
+    static_assert((N & (N - 1)) == 0, "Queue capacity must be a power of two");
+
+    T slots[N];
+    alignas(64) std::atomic<size_t> head{0};    /* next slot to pop, consumer */
+    alignas(64) std::atomic<size_t> tail{0};    /* next slot to push, producer */
+
+public:
+    bool push(const T& item) {
+        size_t pos = tail.load(std::memory_order_relaxed);
+        if (pos - head.load(std::memory_order_acquire) == N) {
+            return false;
+        }
+        slots[pos % N] = item;
+        tail.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& item) {
+        size_t pos = head.load(std::memory_order_relaxed);
+        if (pos == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = slots[pos % N];
+        head.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+/* State of the completion slot of a command */
+enum class PoeCommandState : uint8_t {
+    QUEUED,         /* waits for the control loop */
+    APPLYING,       /* taken by the control loop, can't be cancelled any more */
+    DONE,           /* result is ready */
+    CANCELLED       /* the socket thread gave up, the control loop drops it */
+};
+
+/* Completion slot of a command in flight, the slot of seq is seq % POE_COMMANDS_CAPACITY */
+struct PoeCommandSlot {
+    uint64_t seq = 0;       /* 0 if free */
+    PoeCommandState state = PoeCommandState::QUEUED;
+    PoeCommandResult result{};
+};
+
+/* Commands of the socket threads applied by the control loop at its cycle boundary, so the loop is the only one
+ * touching the ports. The commands of the cycle are applied together on the next cycle, the loop isn't woken up.
+ * The submits are serialized only for the push, to keep one producer, and wait for their slots outside of it
+ */
+class PoeCommandQueue {
+private:
+    SpscQueue<PoeCommand, POE_COMMANDS_CAPACITY> commands;
+    std::mutex submit_lock;
+    uint64_t next_seq = 1;
+    std::atomic<uint64_t> timeout_us{POE_COMMAND_TIMEOUT_US};
+
+    /* Completion slots, guarded by slots_lock */
+    std::mutex slots_lock;
+    std::condition_variable slots_cv;
+    PoeCommandSlot slots[POE_COMMANDS_CAPACITY];
+
+    bool take(const PoeCommand& command);
+    void complete(const PoeCommandResult& result);
+
+public:
+    bool submit(PoeCommand command, PoeCommandResult& result, uint64_t timeout_us);
+    bool submit(PoeCommand command, PoeCommandResult& result) { return submit(command, result, getTimeout()); }
+    size_t apply(std::vector<PoeController>& controllers);
+    void setTimeout(uint64_t us) { timeout_us.store(us); }
+    uint64_t getTimeout() const { return timeout_us.load(); }
+};
+
+extern PoeCommandQueue poe_commands;
+
+const char* poeCommandKindToString(PoeCommandKind kind);
+
+#endif //POED_POE_COMMANDS_H
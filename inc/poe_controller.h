@@ -17,54 +17,115 @@
 #ifndef POED_POE_CONTROLLER_H
 #define POED_POE_CONTROLLER_H
 
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <utility>
 #include <vector>
 #include "utils.h"
+#include "poe_reader.h"
 #include "poe_simulator.h"
+#include "stats.h"
 
+/* Port flags kept in PoePortsTelemetry::flags */
+#define POE_PORT_ENABLED        0x01
+#define POE_PORT_ENABLE_PERM    0x02    /* overbudget port is permitted to be powered on again */
+#define POE_PORT_OVERBUDGET     0x04
+/* Flags of the budget decisions, kept in the state checkpoint across restarts */
+#define POE_PORT_CHECKPOINTED   (POE_PORT_ENABLE_PERM | POE_PORT_OVERBUDGET)
+
+/* X(value, name) */
+#define POE_CONTROLLER_HEALTHS(X) \
+    X(OK,       "ok") \
+    X(DEGRADED, "degraded") \
+    X(FAILED,   "failed")
+
+enum class ControllerHealth : uint8_t {
+    POE_CONTROLLER_HEALTHS(POE_ENUM_VALUE)
+    COUNT
+};
+
+/* Data of the controller ports used on every cycle, one dense array per field indexed by the port number */
+struct PoePortsTelemetry {
+    std::vector<double> voltage;
+    std::vector<double> current;
+    std::vector<double> power;
+    std::vector<double> budget;
+    std::vector<double> hysteresis;     /* spare power of the controller needed to restore the port */
+    std::vector<int> priority;
+    std::vector<uint8_t> state;         /* enum PoeState */
+    std::vector<uint8_t> poe_class;     /* class code reported in port_status */
+    std::vector<uint8_t> mode;          /* enum PoeMode */
+    std::vector<uint8_t> flags;         /* POE_PORT_* */
+    std::vector<double> prev_power;     /* power of the previous sample, for the energy integration */
+    std::vector<StatCounter> energy_uj; /* energy delivered since the start or the last reset, uJ */
+    uint64_t checkpoint_gen = 0;        /* changes of POE_PORT_CHECKPOINTED flags */
+
+    void resize(size_t size);
+    size_t size() const { return power.size(); }
+    bool hasFlag(size_t port, uint8_t flag) const { return (flags[port] & flag) != 0; }
+    void setFlag(size_t port, uint8_t flag, bool value);
+};
+
+/* Identity and rarely used data of the port */
 struct PoePort {
-    std::string contr_path;
     std::string name;
     int index;
-    int priority;
-    double voltage;
-    double current;
-    double power;
-    bool enable_flag;
-    bool enable_perm;
-    bool overbudget_flag;
-    enum PoeState state;
-    enum PoeMode mode;
-    double budget;
     bool test_mode;
+    enum PoeMode hw_mode;       /* mode reported by the driver */
+    std::string load_type_str;  /* class as reported in port_status, i.e. "6(0)" */
+    uint64_t shed_cnt;
+    uint64_t restore_cnt;
+    uint64_t flap_cnt;
+    uint64_t last_restore_us;   /* daemon clock, 0 if never restored */
+    uint64_t restore_backoff_us;
+    uint64_t next_restore_us;   /* the port isn't restored before the time */
     PoePortSim port_sim;
-    string mode_str;
-    string voltage_str;
-    string current_str;
-    string state_str;
-    string load_type_str;
 
     PoePort();
 
-    bool getData();
-    bool powerOff();
-    bool powerOn();
-    bool setMode(enum PoeMode mode);
-    void initSim();
+    void initSim(enum PoeMode mode);
 };
 
 struct PoeController {
     std::string path;
     double total_budget{};
     std::vector<PoePort> ports;
+    PoePortsTelemetry telemetry;
+    std::string port_info_raw;
+    std::string port_status_raw;
+    ControllerStats stats;
+    StatCounter energy_uj;              /* energy of all the ports, uJ */
+    uint64_t energy_sample_us = 0;      /* daemon clock time of the previous sample */
+    ControllerHealth health = ControllerHealth::OK;
+    uint32_t failures = 0;              /* failed reads in a row */
+    uint64_t retry_us = 0;              /* next read of a failed controller, daemon clock */
+    uint64_t retry_backoff_us = 0;
+    std::shared_ptr<PoeDriverReader> reader;    /* started with the first read of the hardware ports */
 
+    void resizePorts(size_t size);
+    bool hasHwPorts() const;
+    void startReadPortsData();
+    PoeReadResult readPortsData(uint64_t deadline_us);
+    bool parsePortsData();
     bool getPortsData();
-    PoePort& getLowesPrioPort();
+    bool parsePortData(size_t port, const string& port_params_str, const string& port_status_str);
+    bool simulatePortData(size_t port);
+    bool powerOff(size_t port);
+    bool powerOn(size_t port);
+    bool setPortMode(size_t port, enum PoeMode mode, bool power_on = true);
+    bool adoptPortMode(size_t port, enum PoeMode mode);
+    void accountEnergy(uint64_t sample_us);
+    double getTotalPower() const;
+    size_t getLowesPrioPort() const;
 };
 
 enum PoeMode parsePoeMode(const string& mode);
-string poeModeToString(PoeMode mode);
-string poeStateToString(PoeState state);
+enum PoeMode parseHwPoeMode(const char* mode, size_t len);
+bool parsePoeState(const char* name, size_t len, enum PoeState& state);
+const string& poeModeToString(PoeMode mode);
+bool isPoeModeSupported(PoeMode mode);
+const string& poeStateToString(PoeState state);
+const char* controllerHealthToString(ControllerHealth health);
 
 #endif //POED_POE_CONTROLLER_H
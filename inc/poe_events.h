@@ -0,0 +1,91 @@
+/*
+ * © 2024 Proxeet Limited
+ *
+ * The poed packet is licensed under the GNU Lesser General Public License version 3,
+ * published by the Free Software Foundation.
+ *
+ * You may use, distribute, and modify this code under the terms of the LGPLv3.
+ *
+ * The project is distributed WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU Lesser General Public License version 3 for more details.
+ *
+ * Author: Aleksey Vasilenko (a.vasilenko@proxeet.com)
+ */
+
+#ifndef POED_POE_EVENTS_H
+#define POED_POE_EVENTS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/* Size of the journal, a power of two, the oldest events are overwritten */
+#define POE_EVENTS_CAPACITY    1024
+/* Port of the events concerning the whole controller */
+#define POE_EVENT_NO_PORT      0xFFFF
+
+/* X(value, name) */
+#define POE_EVENT_KINDS(X) \
+    X(SHED_PORT_BUDGET,  "shed_port_budget") \
+    X(SHED_TOTAL_BUDGET, "shed_total_budget") \
+    X(RESTORE,           "restore") \
+    X(FLAP,              "flap") \
+    X(READ_FAULT,        "read_fault") \
+    X(ACTUATE_FAULT,     "actuate_fault")
+
+#define POE_EVENT_KIND_VALUE(value, ...) value,
+
+enum class PoeEventKind : uint8_t {
+    POE_EVENT_KINDS(POE_EVENT_KIND_VALUE)
+    COUNT
+};
+
+/* Budget decision or fault of the control loop. The budget is the one that was exceeded,
+ * the port one or the controller one, total is the power of the controller ports at the time
+ */
+struct PoeEvent {
+    uint64_t seq;           /* starts from 1, 0 is never used */
+    uint64_t time_us;       /* monotonic daemon clock */
+    uint64_t realtime_us;
+    double power;
+    double budget;
+    double total;
+    uint16_t controller;
+    uint16_t port;
+    uint8_t kind;           /* enum PoeEventKind */
+    uint8_t reserved[3];
+};
+
+#define POE_EVENT_WORDS    (sizeof(PoeEvent) / sizeof(uint64_t))
+
+static_assert(sizeof(PoeEvent) % sizeof(uint64_t) == 0, "Event must be a whole number of words");
+
+/* Fixed ring of the events. The control loop is the only writer and never waits,
+ * readers never block it: every slot has a sequence lock and a reader drops the events overwritten under it
+ */
+class PoeEventJournal {
+private:
+    struct Slot {
+        std::atomic<uint64_t> version{0};   /* 2 * seq when event seq is complete, odd while it is written */
+        std::atomic<uint64_t> words[POE_EVENT_WORDS];
+    };
+
+    Slot slots[POE_EVENTS_CAPACITY];
+    std::atomic<uint64_t> last_seq{0};
+
+public:
+    PoeEventJournal();
+
+    void push(PoeEventKind kind, size_t controller, size_t port, double power, double budget, double total);
+    uint64_t read(uint64_t since, std::vector<PoeEvent>& events, uint64_t& dropped) const;
+    uint64_t getLastSeq() const { return last_seq.load(std::memory_order_acquire); }
+};
+
+extern PoeEventJournal poe_events;
+
+const char* poeEventKindToString(PoeEventKind kind);
+
+#endif //POED_POE_EVENTS_H
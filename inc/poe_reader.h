@@ -0,0 +1,66 @@
+/*
+ * © 2024 Proxeet Limited
+ *
+ * The poed packet is licensed under the GNU Lesser General Public License version 3,
+ * published by the Free Software Foundation.
+ *
+ * You may use, distribute, and modify this code under the terms of the LGPLv3.
+ *
+ * The project is distributed WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU Lesser General Public License version 3 for more details.
+ *
+ * Author: Aleksey Vasilenko (a.vasilenko@proxeet.com)
+ */
+
+#ifndef POED_POE_READER_H
+#define POED_POE_READER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+enum class PoeReadResult {
+    OK,
+    FAILED,
+    TIMEOUT
+};
+
+/* Reads port_info and port_status of one controller in its own thread, the control loop only waits for
+ * the result until the deadline. A read hung in the driver keeps the thread, not the loop, the next reads
+ * time out at once until it returns, and its late result is dropped
+ */
+class PoeDriverReader {
+private:
+    /* Shared with the thread, which may outlive the reader while it is stuck in the driver */
+    struct State {
+        std::mutex lock;
+        std::condition_variable cv;
+        std::string path;
+        bool requested = false;     /* read asked for and not taken by the thread yet */
+        bool busy = false;          /* read in the driver */
+        bool done = false;          /* result of the last read is ready */
+        bool ok = false;
+        bool stopped = false;
+        std::string info;
+        std::string status;
+        std::string failed_path;
+    };
+
+    std::shared_ptr<State> state;
+    bool started = false;           /* read of the current cycle was started */
+
+    static void run(std::shared_ptr<State> state);
+
+public:
+    explicit PoeDriverReader(const std::string& path);
+    ~PoeDriverReader();
+
+    void start();
+    PoeReadResult wait(uint64_t deadline_us, std::string& info, std::string& status);
+};
+
+#endif //POED_POE_READER_H
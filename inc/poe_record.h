@@ -0,0 +1,91 @@
+/*
+ * © 2024 Proxeet Limited
+ *
+ * The poed packet is licensed under the GNU Lesser General Public License version 3,
+ * published by the Free Software Foundation.
+ *
+ * You may use, distribute, and modify this code under the terms of the LGPLv3.
+ *
+ * The project is distributed WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU Lesser General Public License version 3 for more details.
+ *
+ * Author: Aleksey Vasilenko (a.vasilenko@proxeet.com)
+ */
+
+#ifndef POED_POE_RECORD_H
+#define POED_POE_RECORD_H
+
+#include <cstdint>
+
+/* The header has no dependencies, it is shipped with poed_shm.h to the readers of the shared memory snapshot */
+
+/* Port fields of the daemon in one place, the JSON responses, the metrics, the binary record
+ * and the driver line parser are generated from the list, so a new field is one line here.
+ *
+ * X(id, kind, in JSON, metric family or nullptr, metric unit, metric help, value of port i of controller c,
+ *   driver file, column)
+ *
+ * The id is also the JSON name and the record member. Kinds are DOUBLE, INT, BOOL, STATE, MODE,
+ * STRING, COUNTER and ENERGY (uJ counter exposed in J), the kind defines the JSON encoding,
+ * the record member type and the metric type.
+ * The driver file is INFO (port_info) or STATUS (port_status) for the fields read from the driver,
+ * the value is parsed from the column of the port line. NONE fields are kept by the daemon.
+ * Metrics are rendered in the order of the list
+ */
+#define POE_PORT_FIELDS(X) \
+    X(name, STRING, true, nullptr, "", "", c.ports[i].name, NONE, 0) \
+    X(index, INT, true, nullptr, "", "", c.ports[i].index, NONE, 0) \
+    X(voltage, DOUBLE, true, "poed_port_voltage_volts", "volts", "Port output voltage.", \
+      c.telemetry.voltage[i], INFO, 3) \
+    X(current, DOUBLE, true, "poed_port_current_amperes", "amperes", "Port output current.", \
+      c.telemetry.current[i], INFO, 4) \
+    X(power, DOUBLE, true, "poed_port_power_watts", "watts", "Port output power.", \
+      c.telemetry.power[i], NONE, 0) \
+    X(budget, DOUBLE, true, "poed_port_budget_watts", "watts", "Port power budget.", \
+      c.telemetry.budget[i], NONE, 0) \
+    X(priority, INT, true, "poed_port_priority", "", "Port power priority, 1 is the highest.", \
+      c.telemetry.priority[i], NONE, 0) \
+    X(state, STATE, true, "poed_port_detection_state", "", "Port detection state code as reported in port_status.", \
+      c.telemetry.state[i], STATUS, 2) \
+    X(mode, MODE, true, nullptr, "", "", c.telemetry.mode[i], NONE, 0) \
+    X(load_class, STRING, true, nullptr, "", "", c.ports[i].load_type_str, STATUS, 3) \
+    X(enable_flag, BOOL, true, "poed_port_enabled", "", "Port power is enabled.", \
+      c.telemetry.hasFlag(i, POE_PORT_ENABLED), NONE, 0) \
+    X(overbudget_flag, BOOL, true, "poed_port_overbudget", "", "Port is powered off because of overbudget.", \
+      c.telemetry.hasFlag(i, POE_PORT_OVERBUDGET), NONE, 0) \
+    X(sheds, COUNTER, false, "poed_port_sheds", "", "Port power offs caused by overbudget.", \
+      c.ports[i].shed_cnt, NONE, 0) \
+    X(restores, COUNTER, false, "poed_port_restores", "", "Port power ons after overbudget.", \
+      c.ports[i].restore_cnt, NONE, 0) \
+    X(flaps, COUNTER, false, "poed_port_flaps", "", "Port sheds soon after its restore.", \
+      c.ports[i].flap_cnt, NONE, 0) \
+    X(restore_backoff, DOUBLE, false, "poed_port_restore_backoff_seconds", "seconds", \
+      "Delay of the port restores after the last flap.", c.ports[i].restore_backoff_us / 1e6, NONE, 0) \
+    X(hysteresis, DOUBLE, false, nullptr, "", "", c.telemetry.hysteresis[i], NONE, 0) \
+    X(energy_uj, ENERGY, false, "poed_port_energy_joules", "joules", "Energy delivered by the port.", \
+      c.telemetry.energy_uj[i].get(), NONE, 0)
+
+/* Size of the string members of the record including the terminating zero, longer values are cut */
+#define POE_RECORD_STR_LEN    32
+
+/* Binary encoding of the port, one member per field of the schema, fixed size and no pointers.
+ * 64-bit members are aligned to 8 on 32-bit targets too, so the layout is the same everywhere.
+ * The record is a part of the shared memory layout, see the checks in poed_shm.h
+ */
+#define POE_RECORD_TYPE_DOUBLE(id)     alignas(8) double id;
+#define POE_RECORD_TYPE_INT(id)        int32_t id;
+#define POE_RECORD_TYPE_BOOL(id)       uint8_t id;
+#define POE_RECORD_TYPE_STATE(id)      uint8_t id;
+#define POE_RECORD_TYPE_MODE(id)       uint8_t id;
+#define POE_RECORD_TYPE_STRING(id)     char id[POE_RECORD_STR_LEN];
+#define POE_RECORD_TYPE_COUNTER(id)    alignas(8) uint64_t id;
+#define POE_RECORD_TYPE_ENERGY(id)     alignas(8) uint64_t id;
+#define POE_RECORD_MEMBER(id, kind, ...) POE_RECORD_TYPE_##kind(id)
+
+struct PoePortRecord {
+    POE_PORT_FIELDS(POE_RECORD_MEMBER)
+};
+
+#endif //POED_POE_RECORD_H
@@ -0,0 +1,77 @@
+/*
+ * © 2024 Proxeet Limited
+ *
+ * The poed packet is licensed under the GNU Lesser General Public License version 3,
+ * published by the Free Software Foundation.
+ *
+ * You may use, distribute, and modify this code under the terms of the LGPLv3.
+ *
+ * The project is distributed WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU Lesser General Public License version 3 for more details.
+ *
+ * Author: Aleksey Vasilenko (a.vasilenko@proxeet.com)
+ */
+
+#ifndef POED_POE_SCENARIO_H
+#define POED_POE_SCENARIO_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "poe_controller.h"
+#include "poe_simulator.h"
+#include "poed_config.h"
+
+enum class PoeScenarioPhaseType {
+    DETECT,       /* Detection and classification, the port reports the class but delivers no power */
+    INRUSH,       /* Short current spike right after power up */
+    RAMP,         /* Load changes linearly from one power to another */
+    STEP,         /* Constant load */
+    DISCONNECT    /* PD is unplugged, the port is open */
+};
+
+struct PoeScenarioPhase {
+    PoeScenarioPhaseType type;
+    int steps;
+    double voltage;         /* Negative means the working voltage of the port mode */
+    double voltage_noise;
+    double power_from;      /* W, the same as power_to unless the phase is a ramp */
+    double power_to;
+    double noise;           /* Current variation as a share of the load */
+};
+
+struct PoeScenarioProfile {
+    int poe_class;
+    bool loop;
+    std::vector<PoeScenarioPhase> phases;
+};
+
+struct PoeScenarioRule {
+    std::string match;      /* fnmatch() pattern of the port name */
+    std::string profile;
+    int offset_steps;       /* Delay of the profile start on the port */
+    int stagger_steps;      /* Extra delay of every next port matched by the rule */
+    int matched;
+};
+
+/* Declarative per-port load profiles for test mode, loaded from a JSON file */
+class PoeScenario {
+private:
+    std::map<std::string, PoeScenarioProfile> profiles;
+    std::vector<PoeScenarioRule> rules;
+
+    bool parsePhase(const nlohmann::json& phase_json, int poe_class, PoeScenarioPhase& phase);
+
+public:
+    bool load(const std::string& path);
+    bool parse(const nlohmann::json& scenario_json);
+    bool apply(PoePort& port, enum PoeMode mode);
+};
+
+double getPoeClassPower(int poe_class);
+bool generateSimTopology(const std::string& spec, PoedConfig& config);
+
+#endif //POED_POE_SCENARIO_H
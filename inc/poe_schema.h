@@ -0,0 +1,72 @@
+/*
+ * © 2024 Proxeet Limited
+ *
+ * The poed packet is licensed under the GNU Lesser General Public License version 3,
+ * published by the Free Software Foundation.
+ *
+ * You may use, distribute, and modify this code under the terms of the LGPLv3.
+ *
+ * The project is distributed WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU Lesser General Public License version 3 for more details.
+ *
+ * Author: Aleksey Vasilenko (a.vasilenko@proxeet.com)
+ */
+
+#ifndef POED_POE_SCHEMA_H
+#define POED_POE_SCHEMA_H
+
+#include <cstdint>
+#include <string>
+#include <nlohmann/json.hpp>
+#include "poe_controller.h"
+#include "poe_record.h"
+
+enum class PoeFieldKind {
+    DOUBLE,
+    INT,
+    BOOL,
+    STATE,
+    MODE,
+    STRING,
+    COUNTER,
+    ENERGY
+};
+
+#define POE_FIELD_ENUM(id, ...) id,
+
+enum class PoePortField {
+    POE_PORT_FIELDS(POE_FIELD_ENUM)
+    COUNT
+};
+
+struct PoePortFieldInfo {
+    const char* name;
+    PoeFieldKind kind;
+    bool json;
+    const char* metric;
+    const char* unit;
+    const char* help;
+};
+
+#define POE_FIELD_INFO(id, kind, json, metric, unit, help, value, ...) {#id, PoeFieldKind::kind, json, metric, unit, help},
+
+constexpr PoePortFieldInfo poe_port_fields[] = {
+    POE_PORT_FIELDS(POE_FIELD_INFO)
+};
+
+static_assert(sizeof(poe_port_fields) / sizeof(poe_port_fields[0]) == (size_t)PoePortField::COUNT,
+              "Port fields table doesn't match the fields enum");
+
+/* FNV-1a of the field name, evaluated at compile time for the names of the schema */
+constexpr uint32_t poeFieldHash(const char* name, uint32_t hash = 2166136261u) {
+    return *name ? poeFieldHash(name + 1, (hash ^ (uint8_t)*name) * 16777619u) : hash;
+}
+
+bool findPortField(const std::string& name, PoePortField& field);
+void writePortFieldJson(PoePortField field, nlohmann::json& j_port, const PoeController& c, size_t i);
+double getPortFieldValue(PoePortField field, const PoeController& c, size_t i);
+void encodePortRecord(const PoeController& c, size_t i, PoePortRecord& record);
+
+#endif //POED_POE_SCHEMA_H
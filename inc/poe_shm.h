@@ -0,0 +1,47 @@
+/*
+ * © 2024 Proxeet Limited
+ *
+ * The poed packet is licensed under the GNU Lesser General Public License version 3,
+ * published by the Free Software Foundation.
+ *
+ * You may use, distribute, and modify this code under the terms of the LGPLv3.
+ *
+ * The project is distributed WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU Lesser General Public License version 3 for more details.
+ *
+ * Author: Aleksey Vasilenko (a.vasilenko@proxeet.com)
+ */
+
+
+#ifndef POED_POE_SHM_H
+#define POED_POE_SHM_H
+
+#include <string>
+#include <vector>
+#include "poe_controller.h"
+#include "poed_shm.h"
+
+/* Publisher of the shared memory snapshot, see poed_shm.h for the layout and the reader */
+class PoeShm {
+private:
+    std::string name;
+    uint8_t* map = nullptr;
+    size_t map_size = 0;
+
+    PoedShmHeader* header() {
+        return reinterpret_cast<PoedShmHeader*>(map);
+    }
+
+public:
+    ~PoeShm();
+
+    bool open(const std::string& name, const std::vector<PoeController>& controllers);
+    void publish(const std::vector<PoeController>& controllers, uint64_t cycle);
+    void close();
+};
+
+extern PoeShm poe_shm;
+
+#endif //POED_POE_SHM_H
@@ -17,12 +17,21 @@
 #ifndef POED_POE_SIMULATOR_H
 #define POED_POE_SIMULATOR_H
 
+#include <cstdint>
 #include <iostream>
 #include <random>
-#include <sstream>
 #include <string>
 #include "utils.h"
 
+/* One simulated reading of a port, the values the driver reports in port_info and port_status */
+struct PoeSimSample {
+    double voltage;
+    double current;
+    enum PoeState state;
+    const string* state_str;
+    const string* class_str;
+};
+
 class PoeSimProfile {
 private:
     int steps_total;
@@ -35,22 +44,22 @@ private:
     double curr_increment;
     string state;
     string poe_class;
+    enum PoeState state_code;
     bool enabled;
 
-    static string to_string(double value, int precision);
+    static mt19937& generator();
 
 public:
     PoeSimProfile(int steps, double volt, double volt_var,
                   double curr_init, double curr_var, double curr_inc,
                   string state, string poe_class);
 
-    string getPortInfo();
-    string getPortStatus();
-    vector<string> getData();
+    bool getSample(PoeSimSample& sample);
     void reset();
     void turnOn();
     void turnOff();
 
+    static void seed(uint32_t value);
     static double generateRandomDouble(double min, double max);
     static int generateRandomNumber(int min, int max);
 };
@@ -58,28 +67,21 @@ public:
 class PoePortSim {
 private:
     vector<PoeSimProfile> sim_profiles;
-    int curr_profile;
+    size_t curr_profile;
+    bool loop;
+    bool enabled;
 
 public:
     PoePortSim(vector<PoeSimProfile> profiles);
     PoePortSim();
 
     void addProfile(const PoeSimProfile& profile);
-    vector<string> getData();
+    void setLoop(bool loop);
+    bool getSample(PoeSimSample& sample);
     void reset();
 
     void turnOff();
     void turnOn();
 };
 
-class PoeDataSim {
-private:
-    vector<PoePortSim> ports_data;
-
-public:
-    void addPortSim(const PoePortSim& port_sim);
-    vector<string> getData();
-};
-
-
 #endif //POED_POE_SIMULATOR_H
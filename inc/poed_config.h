@@ -0,0 +1,66 @@
+/*
+ * © 2024 Proxeet Limited
+ *
+ * The poed packet is licensed under the GNU Lesser General Public License version 3,
+ * published by the Free Software Foundation.
+ *
+ * You may use, distribute, and modify this code under the terms of the LGPLv3.
+ *
+ * The project is distributed WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU Lesser General Public License version 3 for more details.
+ *
+ * Author: Aleksey Vasilenko (a.vasilenko@proxeet.com)
+ */
+
+#ifndef POED_POED_CONFIG_H
+#define POED_POED_CONFIG_H
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "uci_config.h"
+#include "utils.h"
+
+#define POED_CONFIG_NO_PORT    ((size_t)-1)
+
+struct PortConfig {
+    std::string name;
+    size_t controller;
+    size_t index;           /* port_number in the controller */
+    double budget;
+    int priority;
+    enum PoeMode mode;
+    double hysteresis = -1.0;   /* negative if the port uses the one of the controller */
+};
+
+struct ControllerConfig {
+    std::string path;
+    size_t ports_num;
+    double total_budget;
+    double hysteresis;
+    std::vector<size_t> ports;  /* index of PortConfig by the port number, POED_CONFIG_NO_PORT if not configured */
+};
+
+/* UCI package of the daemon compiled into typed structures, validated on the way */
+struct PoedConfig {
+    std::string log_level;
+    bool unix_socket_enable = false;
+    std::string unix_socket_path;
+    int metrics_http_port = 0;
+    std::vector<ControllerConfig> controllers;
+    std::vector<PortConfig> ports;
+    std::unordered_map<std::string, size_t> port_names;    /* index of PortConfig by the port name */
+
+    bool compile(const UciConfig& config, bool check_hw);
+    bool compileGeneral(const UciSection& section);
+    bool compileControllers(const vector<UciSection>& sections, bool check_hw);
+    bool compilePorts(const vector<UciSection>& sections);
+    void clearTopology();
+    void addController(const std::string& path, size_t ports_num, double total_budget,
+                       double hysteresis = POE_DEFAULT_HYSTERESIS);
+    bool addPort(const PortConfig& port);
+};
+
+#endif //POED_POED_CONFIG_H
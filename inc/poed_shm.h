@@ -0,0 +1,214 @@
+/*
+ * © 2024 Proxeet Limited
+ *
+ * The poed packet is licensed under the GNU Lesser General Public License version 3,
+ * published by the Free Software Foundation.
+ *
+ * You may use, distribute, and modify this code under the terms of the LGPLv3.
+ *
+ * The project is distributed WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU Lesser General Public License version 3 for more details.
+ *
+ * Author: Aleksey Vasilenko (a.vasilenko@proxeet.com)
+ */
+
+
+#ifndef POED_POED_SHM_H
+#define POED_POED_SHM_H
+
+/* Shared memory snapshot of the daemon, the header is the whole reader library.
+ *
+ * The daemon publishes the port records of the last cycle into the POSIX shared memory segment POED_SHM_NAME,
+ * local agents map it read only and copy consistent snapshots at any rate without talking to the daemon:
+ *
+ *     PoedShmReader reader;
+ *     PoedShmSnapshot snapshot;
+ *     if (reader.open() && reader.read(snapshot)) {
+ *         for (const PoePortRecord& port: snapshot.ports) ...
+ *     }
+ *
+ * The segment is the header, the controllers and the port records of all the controllers in turn.
+ * The layout is fixed for the version, the sizes of the parts are in the header, so a reader checks them
+ * before the first read. The header seq is a seqlock: odd while the daemon writes the snapshot,
+ * a copy is consistent if seq was even and the same before and after it.
+ * State, mode and health are the codes of the daemon enums, i.e. state 4 is DET_OK, health 0 is ok
+ */
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "poe_record.h"
+
+#define POED_SHM_NAME       "/poed"
+#define POED_SHM_MAGIC      0x4D485350u   /* "PSHM" */
+#define POED_SHM_VERSION    1
+
+struct PoedShmHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t controller_size;
+    uint32_t record_size;
+    uint32_t controllers;
+    uint32_t ports;                 /* records of all the controllers */
+    uint64_t size;                  /* of the whole segment */
+    std::atomic<uint64_t> seq;
+    /* Written under the seqlock */
+    uint64_t cycle;                 /* control cycles of the daemon */
+    uint64_t time_us;               /* daemon clock time of the snapshot */
+    uint64_t realtime_us;           /* wall clock time of the snapshot */
+    uint32_t closed;                /* the daemon doesn't publish to the segment anymore, reopen it */
+    uint32_t reserved;
+};
+
+struct PoedShmController {
+    double total_budget;
+    double total_power;
+    uint64_t energy_uj;
+    uint32_t first_port;            /* index of the first record of the controller */
+    uint32_t ports;
+    uint8_t health;
+    uint8_t reserved[7];
+};
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "Seqlock of the shared memory needs lock-free 64-bit atomics");
+
+/* The layout is the interface with the readers built against other versions of the header.
+ * A change of PoedShmHeader, PoedShmController or PoePortRecord, i.e. a new port field, must bump
+ * POED_SHM_VERSION and these checks
+ */
+static_assert(sizeof(PoedShmHeader) == 72, "PoedShmHeader layout changed, bump POED_SHM_VERSION");
+static_assert(offsetof(PoedShmHeader, seq) == 32 && offsetof(PoedShmHeader, cycle) == 40 &&
+              offsetof(PoedShmHeader, closed) == 64, "PoedShmHeader layout changed, bump POED_SHM_VERSION");
+static_assert(sizeof(PoedShmController) == 40 && offsetof(PoedShmController, energy_uj) == 16 &&
+              offsetof(PoedShmController, health) == 32, "PoedShmController layout changed, bump POED_SHM_VERSION");
+static_assert(sizeof(PoePortRecord) == 160, "PoePortRecord layout changed, bump POED_SHM_VERSION");
+static_assert(offsetof(PoePortRecord, index) == 32 && offsetof(PoePortRecord, voltage) == 40 &&
+              offsetof(PoePortRecord, power) == 56 && offsetof(PoePortRecord, priority) == 72 &&
+              offsetof(PoePortRecord, state) == 76 && offsetof(PoePortRecord, load_class) == 78 &&
+              offsetof(PoePortRecord, sheds) == 112 && offsetof(PoePortRecord, energy_uj) == 152,
+              "PoePortRecord layout changed, bump POED_SHM_VERSION");
+
+struct PoedShmSnapshot {
+    uint64_t seq = 0;
+    uint64_t cycle = 0;
+    uint64_t time_us = 0;
+    uint64_t realtime_us = 0;
+    std::vector<PoedShmController> controllers;
+    std::vector<PoePortRecord> ports;
+};
+
+class PoedShmReader {
+private:
+    const uint8_t* map = nullptr;
+    size_t map_size = 0;
+
+    const PoedShmHeader* header() const {
+        return reinterpret_cast<const PoedShmHeader*>(map);
+    }
+
+public:
+    PoedShmReader() = default;
+    PoedShmReader(const PoedShmReader&) = delete;
+    PoedShmReader& operator=(const PoedShmReader&) = delete;
+
+    ~PoedShmReader() {
+        close();
+    }
+
+    /* Map the segment and check its layout, false if there is no segment or it has another layout */
+    bool open(const char* name = POED_SHM_NAME) {
+        close();
+        int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st{};
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(PoedShmHeader)) {
+            ::close(fd);
+            return false;
+        }
+        void* ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (ptr == MAP_FAILED) {
+            return false;
+        }
+        map = static_cast<const uint8_t*>(ptr);
+        map_size = st.st_size;
+
+        const PoedShmHeader* h = header();
+        if (h->magic != POED_SHM_MAGIC || h->version != POED_SHM_VERSION ||
+                h->header_size != sizeof(PoedShmHeader) || h->controller_size != sizeof(PoedShmController) ||
+                h->record_size != sizeof(PoePortRecord) || h->size > map_size ||
+                h->size != sizeof(PoedShmHeader) + (uint64_t)h->controllers * sizeof(PoedShmController) +
+                           (uint64_t)h->ports * sizeof(PoePortRecord)) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        if (map != nullptr) {
+            munmap(const_cast<uint8_t*>(map), map_size);
+            map = nullptr;
+            map_size = 0;
+        }
+    }
+
+    bool isOpen() const {
+        return map != nullptr;
+    }
+
+    /* Current seq, a reader polling for new snapshots compares it with the seq of its last snapshot */
+    uint64_t getSeq() const {
+        return map != nullptr ? header()->seq.load(std::memory_order_acquire) : 0;
+    }
+
+    /* Copy a consistent snapshot, false if the daemon closed the segment
+     * or it was being written on every attempt
+     */
+    bool read(PoedShmSnapshot& snapshot, unsigned attempts = 1000) const {
+        if (map == nullptr) {
+            return false;
+        }
+        const PoedShmHeader* h = header();
+        const uint8_t* controllers_ptr = map + sizeof(PoedShmHeader);
+        const uint8_t* ports_ptr = controllers_ptr + h->controllers * sizeof(PoedShmController);
+        snapshot.controllers.resize(h->controllers);
+        snapshot.ports.resize(h->ports);
+
+        for (unsigned attempt = 0; attempt < attempts; attempt++) {
+            uint64_t seq = h->seq.load(std::memory_order_acquire);
+            if (seq & 1) {
+                continue;
+            }
+            uint32_t closed = h->closed;
+            snapshot.cycle = h->cycle;
+            snapshot.time_us = h->time_us;
+            snapshot.realtime_us = h->realtime_us;
+            memcpy(snapshot.controllers.data(), controllers_ptr, h->controllers * sizeof(PoedShmController));
+            memcpy(snapshot.ports.data(), ports_ptr, h->ports * sizeof(PoePortRecord));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (h->seq.load(std::memory_order_relaxed) != seq) {
+                continue;
+            }
+            if (closed) {
+                return false;
+            }
+            snapshot.seq = seq;
+            return true;
+        }
+        return false;
+    }
+};
+
+#endif //POED_POED_SHM_H
@@ -0,0 +1,103 @@
+/*
+ * © 2024 Proxeet Limited
+ *
+ * The poed packet is licensed under the GNU Lesser General Public License version 3,
+ * published by the Free Software Foundation.
+ *
+ * You may use, distribute, and modify this code under the terms of the LGPLv3.
+ *
+ * The project is distributed WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU Lesser General Public License version 3 for more details.
+ *
+ * Author: Aleksey Vasilenko (a.vasilenko@proxeet.com)
+ */
+
+#ifndef POED_STATS_H
+#define POED_STATS_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+/* Histogram buckets: exact values below 4 us, then 4 linear sub-buckets per power of two up to 2^30 us (~1073 s) */
+#define LATENCY_HIST_SUB_BUCKETS     4
+#define LATENCY_HIST_BUCKETS         (LATENCY_HIST_SUB_BUCKETS * 29)
+
+uint64_t monotonicUs();
+
+/* Counter written by the control loop and read by the socket server */
+class StatCounter {
+private:
+    std::atomic<uint64_t> value;
+
+public:
+    StatCounter() : value(0) {}
+    StatCounter(const StatCounter& other) : value(other.get()) {}
+    StatCounter& operator=(const StatCounter& other) { value.store(other.get(), std::memory_order_relaxed); return *this; }
+
+    void add(uint64_t n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+    void set(uint64_t n) { value.store(n, std::memory_order_relaxed); }
+    uint64_t get() const { return value.load(std::memory_order_relaxed); }
+    uint64_t take() { return value.exchange(0, std::memory_order_relaxed); }   /* read and reset at once */
+};
+
+/* Fixed-bucket latency histogram in microseconds, lock-free on both sides */
+class LatencyHistogram {
+private:
+    std::atomic<uint32_t> buckets[LATENCY_HIST_BUCKETS];
+    StatCounter count;
+    StatCounter max_us;
+
+    static size_t bucketIndex(uint64_t us);
+    static uint64_t bucketUpperBound(size_t index);
+
+public:
+    LatencyHistogram();
+    LatencyHistogram(const LatencyHistogram& other);
+    LatencyHistogram& operator=(const LatencyHistogram& other);
+
+    void add(uint64_t us);
+    uint64_t getCount() const { return count.get(); }
+    uint64_t getMax() const { return max_us.get(); }
+    uint64_t getPercentile(double percentile) const;
+};
+
+enum CyclePhase {
+    PHASE_READ = 0,   /* sysfs reads */
+    PHASE_PARSE,      /* port_info/port_status parsing, simulation in test mode */
+    PHASE_DECIDE,     /* budget decisions */
+    PHASE_ACTUATE,    /* power on/off writes */
+    PHASE_COUNT
+};
+
+const char* cyclePhaseToString(CyclePhase phase);
+
+struct ControllerStats {
+    LatencyHistogram phases[PHASE_COUNT];
+    StatCounter failed_reads;
+    StatCounter failed_writes;
+    StatCounter sheds;
+    StatCounter restores;
+    StatCounter flaps;              /* sheds soon after the restore of the port */
+};
+
+struct DaemonStats {
+    LatencyHistogram cycle;         /* whole control cycle over all controllers */
+    LatencyHistogram off_cpu;       /* part of the cycle the thread wasn't running */
+    LatencyHistogram wakeup_delay;  /* oversleep of the period sleep */
+    StatCounter cycles;
+    StatCounter overruns;           /* cycles longer than the monitoring period */
+    StatCounter last_cycle_us;
+    StatCounter uptime_us;          /* time of the control loop run on the daemon clock */
+    LatencyHistogram command_latency;   /* from the socket request to the applied command */
+    StatCounter commands;
+};
+
+extern DaemonStats poe_stats;
+
+uint64_t threadCpuTimeUs();
+bool getProcessUsage(uint64_t& rss_kb, uint64_t& user_us, uint64_t& system_us);
+
+#endif //POED_STATS_H
@@ -42,11 +42,6 @@ public:
     const map<string, vector<UciSection>> & getSections() const;
     void dump();
 
-    /* Method to validate the presence of a section and its options,
-     * size_t occurrences == 0 means minimum 1 occurrence
-     * */
-    bool validateSection(const std::string& sectionName, size_t occurrences,
-                         const std::vector<std::string>& requiredOptions) const;
     bool exists();
 };
 
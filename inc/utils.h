@@ -21,39 +21,74 @@ extern "C" {
 #include <uci.h>
 }
 
+#include <ostream>
 #include <string>
 #include <unistd.h>
 #include "uci_config.h"
 
-#define POE_PWR_HYSTERESIS       5
+/* Power the controller must have spare to restore a shed port, W, the hysteresis options override it */
+#define POE_DEFAULT_HYSTERESIS   5.0
+/* A shed of the port within the window after its restore is a flap,
+ * the restores of a flapping port are delayed by a backoff doubling with every flap in a row
+ */
+#define POE_FLAP_WINDOW_US       (60 * 1000000ull)
+#define POE_FLAP_BACKOFF_MIN_US  (10 * 1000000ull)
+#define POE_FLAP_BACKOFF_MAX_US  (15 * 60 * 1000000ull)
+/* Failed reads of a controller in a row before it is failed, a failed controller is retried with a backoff */
+#define POE_CONTROLLER_FAILURES_MAX    3
+#define POE_CONTROLLER_RETRY_MIN_US    (1 * 1000000ull)
+#define POE_CONTROLLER_RETRY_MAX_US    (60 * 1000000ull)
+/* Deadline of the driver reads of the cycle, a controller which misses it is skipped as a failed read */
+#define POE_CONTROLLER_READ_TIMEOUT_US (200 * 1000ull)
+/* Most controllers and ports of a controller. The journal and the checkpoint keep the indexes in 16 bits
+ * with 0xFFFF as the sentinel, so both stay well below it
+ */
+#define POE_CONTROLLERS_MAX      1024
+#define POE_CONTROLLER_PORTS_MAX 1024
+#define POED_PID_FILE            "/var/run/poed.pid"
+#define POED_STATE_FILE          "/var/run/poed.state"
+#define POED_DEFAULT_SOCKET_PATH "/var/run/poed.sock"
+
+/* Enum names in one place: X(value, config name, driver name) */
+#define POE_MODES(X) \
+    X(POE_OFF,  "OFF",  "") \
+    X(POE_AUTO, "AUTO", "auto") \
+    X(POE_48V,  "48V",  "manual") \
+    X(POE_24V,  "24V",  "")
+
+/* X(value, name as reported in port_status), the leading digit is the value */
+#define POE_STATES(X) \
+    X(NONE,     "0(NONE)") \
+    X(DCP,      "1(DCP)") \
+    X(HIGH_CAP, "2(HIGH_CAP)") \
+    X(RLOW,     "3(RLOW)") \
+    X(DET_OK,   "4(DET_OK)") \
+    X(RHIGH,    "5(RHIGH)") \
+    X(OPEN,     "6(OPEN)") \
+    X(DCN,      "7(DCN)")
+
+#define POE_ENUM_VALUE(value, ...) value,
 
 enum class PoeMode {
-    POE_OFF = 0,
-    POE_AUTO,
-    POE_48V,
-    POE_24V
+    POE_MODES(POE_ENUM_VALUE)
+    COUNT
 };
 
 enum class PoeState {
-    NONE = 0,
-    DCP,
-    HIGH_CAP,
-    RLOW,
-    DET_OK,
-    RHIGH,
-    OPEN,
-    DCN
+    POE_STATES(POE_ENUM_VALUE)
+    COUNT
 };
 
 void create_default_config(const std::string& config_path);
 std::string cat(const std::string& filePath);
 void echo(const std::string& filePath, const std::string& content);
 int countLines(const std::string& content, char comment_char);
-bool validateUciConfig(const UciConfig& config);
-std::string getLineByIndex(const std::string& content, int index, char commentChar);
-std::string getSubstringByIndex(const std::string& input, int index);
+std::vector<std::string> getLines(const std::string& content, char commentChar);
+size_t findJsonValueEnd(const std::string& buf, size_t start);
 string requestFromUnixSocket(const string& socket_path, const string& message, int timeout_ms);
-std::vector<pid_t> getProcessIdsByName(const string& processName);
-std::string getProcessName(pid_t pid);
+bool streamFromUnixSocket(const string& socket_path, const string& message, int timeout_ms,
+                          std::ostream& out, string& error_msg);
+int lockPidFile(const std::string& path, const std::string& socket_path);
+std::string getPidFileSocketPath(const std::string& path);
 
 #endif //ROUTER_POED_UTILS_H
@@ -0,0 +1,233 @@
+/*
+ * © 2024 Proxeet Limited
+ *
+ * The poed packet is licensed under the GNU Lesser General Public License version 3,
+ * published by the Free Software Foundation.
+ *
+ * You may use, distribute, and modify this code under the terms of the LGPLv3.
+ *
+ * The project is distributed WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU Lesser General Public License version 3 for more details.
+ *
+ * Author: Aleksey Vasilenko (a.vasilenko@proxeet.com)
+ */
+
+#include "fake_sysfs.h"
+#include "utils.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+#define FAKE_SYSFS_READER_CLOSE_TIMEOUT_MS    100
+
+FakeSysfsController::FakeSysfsController(std::string path, size_t index, size_t ports_num,
+                                         const FakeSysfsOptions& options)
+        : path(std::move(path)), ports(ports_num), options(options), rng(options.seed + ports_num),
+          faulty(options.fault_controller < 0 || index == (size_t)options.fault_controller) {
+    for (size_t i = 0; i < ports.size(); i++) {
+        Port& port = ports[i];
+        port.mode = "auto";
+        port.sim.addProfile(PoeSimProfile(PoeSimProfile::generateRandomNumber(10, 30),
+                                          48.0, PoeSimProfile::generateRandomDouble(0.0, 1.5),
+                                          PoeSimProfile::generateRandomDouble(0.1, 0.2),
+                                          PoeSimProfile::generateRandomDouble(0.0, 0.1),
+                                          PoeSimProfile::generateRandomDouble(0.0, 0.04),
+                                          "4(DET_OK)", "6(0)"));
+        port.sim.addProfile(PoeSimProfile(PoeSimProfile::generateRandomNumber(10, 30),
+                                          0.0, 0.0, 0.0, 0.0, 0.0,
+                                          "6(OPEN)", "0(Unknown)"));
+    }
+}
+
+bool FakeSysfsController::create() {
+    if (mkdir(path.c_str(), 0755) < 0 && errno != EEXIST) {
+        return false;
+    }
+    const char* files[] = {"port_info", "port_status", "port_power_on", "port_power_off", "port_mode"};
+    for (auto file: files) {
+        string file_path = path + "/" + file;
+        unlink(file_path.c_str());
+        if (mkfifo(file_path.c_str(), 0644) < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void FakeSysfsController::start() {
+    thread(&FakeSysfsController::serveRead, this, string("port_info")).detach();
+    thread(&FakeSysfsController::serveRead, this, string("port_status")).detach();
+    thread(&FakeSysfsController::serveWrite, this, string("port_power_on")).detach();
+    thread(&FakeSysfsController::serveWrite, this, string("port_power_off")).detach();
+    thread(&FakeSysfsController::serveWrite, this, string("port_mode")).detach();
+}
+
+bool FakeSysfsController::injectFault(double rate) {
+    return faulty && rate > 0.0 && uniform_real_distribution<>(0.0, 1.0)(rng) < rate;
+}
+
+/* Every port_info read advances the simulation, port_status shows the state of the last sample */
+string FakeSysfsController::renderPortInfo() {
+    string content = "# name mode voltage current\n";
+    char line[128];
+    for (size_t i = 0; i < ports.size(); i++) {
+        Port& port = ports[i];
+        PoeSimSample sample{};
+        if (!port.sim.getSample(sample)) {
+            continue;
+        }
+        snprintf(line, sizeof(line), "%zu eth%zu %s %.1f %.3f\n", i, i, port.mode.c_str(),
+                 sample.voltage, sample.current);
+        port.info_line = line;
+        snprintf(line, sizeof(line), "%zu eth%zu %s %s\n", i, i, sample.state_str->c_str(),
+                 sample.class_str->c_str());
+        port.status_line = line;
+        content += port.info_line;
+    }
+    return content;
+}
+
+string FakeSysfsController::renderPortStatus() {
+    string content = "# name det_st class\n";
+    for (auto& port: ports) {
+        if (port.status_line.empty()) {
+            renderPortInfo();
+        }
+        content += port.status_line;
+    }
+    return content;
+}
+
+void FakeSysfsController::applyWrite(const string& file, const string& content) {
+    /* The driver takes "<index>" for power files and "<index><mode>" for the mode file */
+    size_t digits = content.find_first_not_of("0123456789");
+    if (digits == 0 || content.empty()) {
+        return;
+    }
+    size_t index = stoul(content.substr(0, digits));
+    if (index >= ports.size()) {
+        return;
+    }
+
+    Port& port = ports[index];
+    if (file == "port_power_on") {
+        port.sim.turnOn();
+    } else if (file == "port_power_off") {
+        port.sim.turnOff();
+    } else if (file == "port_mode" && digits != string::npos) {
+        port.mode = content.substr(digits);
+        port.mode.erase(port.mode.find_last_not_of(" \n") + 1);
+    }
+}
+
+/* Serve one reader per FIFO open, wait for it to close before the next one,
+ * otherwise the lingering reader would get the next content appended
+ */
+void FakeSysfsController::serveRead(const string& file) {
+    string file_path = path + "/" + file;
+    int notify_fd = inotify_init1(IN_CLOEXEC);
+    inotify_add_watch(notify_fd, file_path.c_str(), IN_CLOSE_NOWRITE);
+
+    char events[4096];
+    for (;;) {
+        int fd = open(file_path.c_str(), O_WRONLY | O_CLOEXEC);
+        if (fd < 0) {
+            usleep(100000);
+            continue;
+        }
+
+        if (faulty && options.read_latency_us > 0) {
+            usleep(options.read_latency_us);
+        }
+
+        string content;
+        {
+            lock_guard<mutex> guard(lock);
+            content = file == "port_info" ? renderPortInfo() : renderPortStatus();
+            if (injectFault(options.read_error_rate)) {
+                /* Either cut the content in the middle of the line or corrupt the values */
+                if (rng() % 2) {
+                    content.resize(content.size() / 2);
+                } else {
+                    replace(content.begin() + content.find('\n') + 1, content.end(), '.', ',');
+                }
+            }
+        }
+        if (write(fd, content.c_str(), content.size()) < 0) {
+            /* Reader has gone */
+        }
+        close(fd);
+
+        struct pollfd pfd{};
+        pfd.fd = notify_fd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, FAKE_SYSFS_READER_CLOSE_TIMEOUT_MS) > 0) {
+            if (read(notify_fd, events, sizeof(events)) < 0) {
+                continue;
+            }
+        }
+    }
+}
+
+/* Every writer session is one driver command, as the daemon opens the file for each write */
+void FakeSysfsController::serveWrite(const string& file) {
+    string file_path = path + "/" + file;
+    char buffer[256];
+    for (;;) {
+        int fd = open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            usleep(100000);
+            continue;
+        }
+
+        string content;
+        ssize_t num_bytes;
+        while ((num_bytes = read(fd, buffer, sizeof(buffer))) > 0) {
+            content.append(buffer, num_bytes);
+        }
+        close(fd);
+
+        lock_guard<mutex> guard(lock);
+        if (!injectFault(options.write_drop_rate)) {
+            applyWrite(file, content);
+        }
+    }
+}
+
+/* UCI config that points the daemon to the fake controllers */
+string getFakeSysfsUciConfig(const FakeSysfsOptions& options, const vector<FakeSysfsController*>& controllers) {
+    string config;
+    config += "config general\n";
+    config += "\toption log_level 'info'\n";
+    config += "\toption unix_socket_enable '1'\n";
+    config += "\toption unix_socket_path '/var/run/poed.sock'\n\n";
+
+    for (auto controller: controllers) {
+        config += "config controller\n";
+        config += "\toption path '" + controller->getPath() + "'\n";
+        config += "\toption ports '" + to_string(options.ports) + "'\n";
+        config += "\toption total_power_budget '" + to_string(options.ports * 10) + "'\n\n";
+    }
+
+    for (size_t c = 0; c < controllers.size(); c++) {
+        for (size_t p = 0; p < options.ports; p++) {
+            config += "config port\n";
+            config += "\toption name 'c" + to_string(c) + "eth" + to_string(p) + "'\n";
+            config += "\toption controller '" + to_string(c) + "'\n";
+            config += "\toption port_number '" + to_string(p) + "'\n";
+            config += "\toption power_budget '15'\n";
+            config += "\toption mode 'AUTO'\n";
+            config += "\toption priority '" + to_string(1 + p % 4) + "'\n\n";
+        }
+    }
+    return config;
+}
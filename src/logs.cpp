@@ -14,9 +14,30 @@
  * Author: Aleksey Vasilenko (a.vasilenko@proxeet.com)
  */
 
+#include <algorithm>
 #include <string>
+#include <unistd.h>
 #include "logs.h"
 
+using namespace std;
+
+PoeLogger poe_logger;
+
+#define POE_LOG_CATEGORY_INFO(value, name, rate, burst) {name, rate, burst},
+
+static const struct {
+    const char* name;
+    double rate;
+    double burst;
+} log_categories[] = {
+    POE_LOG_CATEGORIES(POE_LOG_CATEGORY_INFO)
+};
+
+const char* logCategoryToString(LogCategory category) {
+    size_t ind = static_cast<size_t>(category);
+    return ind < static_cast<size_t>(LogCategory::COUNT) ? log_categories[ind].name : "unknown";
+}
+
 int get_syslog_level(const std::string& level) {
     if (level == "debug") return LOG_DEBUG;
     else if (level == "info") return LOG_INFO;
@@ -32,4 +53,287 @@ int get_syslog_level(const std::string& level) {
 void initialize_logging(const char* log_name, int log_level) {
     openlog(log_name, LOG_PID | LOG_CONS, LOG_DAEMON);
     setlogmask(LOG_UPTO(log_level));
+    poe_logger.setLevel(log_level);
+}
+
+void PoeLogger::addArg(LogRecord& record, LogArgType type, uint64_t value) {
+    if (record.argc < POE_LOG_MAX_ARGS) {
+        record.types[record.argc] = type;
+        record.args[record.argc] = value;
+        record.argc++;
+    }
+}
+
+void PoeLogger::addStringArg(LogRecord& record, const char* value) {
+    size_t offset = record.text_used;
+    size_t len = value != nullptr ? strlen(value) : 0;
+    if (offset + len + 1 > POE_LOG_TEXT_SIZE) {
+        len = offset < POE_LOG_TEXT_SIZE ? POE_LOG_TEXT_SIZE - offset - 1 : 0;
+    }
+    if (offset < POE_LOG_TEXT_SIZE) {
+        memcpy(record.text + offset, value != nullptr ? value : "", len);
+        record.text[offset + len] = '\0';
+        record.text_used = offset + len + 1 < POE_LOG_TEXT_SIZE ? offset + len + 1 : POE_LOG_TEXT_SIZE;
+    } else {
+        offset = POE_LOG_TEXT_SIZE - 1;
+    }
+    addArg(record, LOG_ARG_STR, offset);
+}
+
+/* printf of the captured arguments: the length modifiers of the format are replaced
+ * with the ones of the captured types, a missing argument is printed as '?'
+ */
+static void formatRecord(const LogRecord& record, string& out) {
+    out.clear();
+    size_t arg = 0;
+    char spec[32];
+    char value[POE_LOG_TEXT_SIZE + 64];
+    for (const char* p = record.fmt; *p != '\0'; p++) {
+        if (*p != '%') {
+            out.push_back(*p);
+            continue;
+        }
+        if (p[1] == '%') {
+            out.push_back('%');
+            p++;
+            continue;
+        }
+        size_t spec_len = 0;
+        spec[spec_len++] = '%';
+        p++;
+        while (*p != '\0' && strchr("-+ #0123456789.", *p) != nullptr && spec_len < sizeof(spec) - 4) {
+            spec[spec_len++] = *p++;
+        }
+        while (*p != '\0' && strchr("hlLqjzt", *p) != nullptr) {
+            p++;
+        }
+        if (*p == '\0') {
+            break;
+        }
+        if (arg >= record.argc) {
+            out.push_back('?');
+            continue;
+        }
+        char conversion = *p;
+        uint64_t raw = record.args[arg];
+        switch (record.types[arg++]) {
+            case LOG_ARG_INT:
+            case LOG_ARG_UINT:
+                if (conversion == 'c') {
+                    spec[spec_len++] = 'c';
+                    spec[spec_len] = '\0';
+                    snprintf(value, sizeof(value), spec, (int)raw);
+                    break;
+                }
+                spec[spec_len++] = 'l';
+                spec[spec_len++] = 'l';
+                spec[spec_len++] = strchr("diuxXo", conversion) != nullptr ? conversion : 'd';
+                spec[spec_len] = '\0';
+                if (record.types[arg - 1] == LOG_ARG_INT) {
+                    snprintf(value, sizeof(value), spec, (long long)(int64_t)raw);
+                } else {
+                    snprintf(value, sizeof(value), spec, (unsigned long long)raw);
+                }
+                break;
+            case LOG_ARG_DOUBLE: {
+                double d;
+                memcpy(&d, &raw, sizeof(d));
+                spec[spec_len++] = strchr("fFeEgGaA", conversion) != nullptr ? conversion : 'g';
+                spec[spec_len] = '\0';
+                snprintf(value, sizeof(value), spec, d);
+                break;
+            }
+            case LOG_ARG_STR:
+            default:
+                spec[spec_len++] = 's';
+                spec[spec_len] = '\0';
+                snprintf(value, sizeof(value), spec,
+                         record.text + (raw < POE_LOG_TEXT_SIZE ? raw : POE_LOG_TEXT_SIZE - 1));
+                break;
+        }
+        out.append(value);
+    }
+    /* syslog adds the line end itself */
+    while (!out.empty() && out.back() == '\n') {
+        out.pop_back();
+    }
+}
+
+PoeLogger::PoeLogger() {
+    for (size_t i = 0; i < POE_LOG_QUEUE_SIZE; i++) {
+        cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+    uint64_t now_us = monotonicUs();
+    for (size_t i = 0; i < (size_t)LogCategory::COUNT; i++) {
+        buckets[i].tokens = log_categories[i].burst;
+        buckets[i].refill_us = now_us;
+    }
+}
+
+PoeLogger::~PoeLogger() {
+    stop();
+}
+
+/* Bounded MPMC queue of D. Vyukov, a cell is free for the position when its seq equals the position */
+bool PoeLogger::push(const LogRecord& record) {
+    size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+    Cell* cell;
+    for (;;) {
+        cell = &cells[pos % POE_LOG_QUEUE_SIZE];
+        size_t seq = cell->seq.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+    cell->record = record;
+    cell->seq.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+/* The drain thread is the only consumer */
+bool PoeLogger::pop(LogRecord& record) {
+    Cell& cell = cells[dequeue_pos % POE_LOG_QUEUE_SIZE];
+    size_t seq = cell.seq.load(std::memory_order_acquire);
+    if ((intptr_t)seq - (intptr_t)(dequeue_pos + 1) < 0) {
+        return false;
+    }
+    record = cell.record;
+    cell.seq.store(dequeue_pos + POE_LOG_QUEUE_SIZE, std::memory_order_release);
+    dequeue_pos++;
+    return true;
+}
+
+void PoeLogger::flushRepeats() {
+    if (repeats > 0) {
+        syslog(last_priority, "Previous message suppressed %llu times", (unsigned long long)repeats);
+        written.add();
+        repeats = 0;
+    }
+}
+
+/* Report the messages dropped by the rate limits once the categories have tokens again */
+void PoeLogger::flushRateLimited(uint64_t now_us) {
+    for (size_t i = 0; i < (size_t)LogCategory::COUNT; i++) {
+        if (rate_limited[i] == 0) {
+            continue;
+        }
+        TokenBucket& bucket = buckets[i];
+        bucket.tokens = min(log_categories[i].burst,
+                            bucket.tokens + (now_us - bucket.refill_us) * log_categories[i].rate / 1e6);
+        bucket.refill_us = now_us;
+        if (bucket.tokens >= 1.0) {
+            bucket.tokens -= 1.0;
+            syslog(LOG_NOTICE, "%llu %s messages suppressed by rate limit",
+                   (unsigned long long)rate_limited[i], log_categories[i].name);
+            written.add();
+            rate_limited[i] = 0;
+        }
+    }
+}
+
+/* Must be called with the output lock held */
+void PoeLogger::output(const LogRecord& record, uint64_t now_us) {
+    static thread_local string text;
+    formatRecord(record, text);
+
+    /* Repeats don't spend the tokens of the category */
+    if (record.priority == last_priority && text == last_text) {
+        if (repeats == 0) {
+            repeat_start_us = now_us;
+        }
+        repeats++;
+        collapsed.add();
+        if (now_us - repeat_start_us >= POE_LOG_REPEAT_FLUSH_US) {
+            flushRepeats();
+        }
+        return;
+    }
+    flushRepeats();
+
+    size_t category = record.category < (size_t)LogCategory::COUNT ? record.category : 0;
+    flushRateLimited(now_us);
+    TokenBucket& bucket = buckets[category];
+    bucket.tokens = min(log_categories[category].burst,
+                        bucket.tokens + (now_us - bucket.refill_us) * log_categories[category].rate / 1e6);
+    bucket.refill_us = now_us;
+    if (bucket.tokens < 1.0) {
+        rate_limited[category]++;
+        rate_limited_total.add();
+        return;
+    }
+    bucket.tokens -= 1.0;
+
+    syslog(record.priority, "%s", text.c_str());
+    written.add();
+    last_text = text;
+    last_priority = record.priority;
+}
+
+void PoeLogger::submit(const LogRecord& record) {
+    if (running.load(std::memory_order_acquire)) {
+        if (!push(record)) {
+            dropped.add();
+        }
+        return;
+    }
+    lock_guard<mutex> guard(output_lock);
+    output(record, monotonicUs());
+}
+
+void PoeLogger::drain() {
+    LogRecord record;
+    for (;;) {
+        bool stop_requested = stopping.load(std::memory_order_acquire);
+        {
+            lock_guard<mutex> guard(output_lock);
+            uint64_t now_us = monotonicUs();
+            while (pop(record)) {
+                output(record, now_us);
+            }
+            if (repeats > 0 && now_us - repeat_start_us >= POE_LOG_REPEAT_FLUSH_US) {
+                flushRepeats();
+            }
+            flushRateLimited(now_us);
+            if (stop_requested) {
+                flushRepeats();
+                return;
+            }
+        }
+        usleep(POE_LOG_DRAIN_PERIOD_US);
+    }
+}
+
+/* Start the drain thread, must be called after daemonizing, threads don't survive fork */
+void PoeLogger::start() {
+    if (running.load()) {
+        return;
+    }
+    stopping.store(false);
+    drain_thread = thread(&PoeLogger::drain, this);
+    running.store(true, std::memory_order_release);
+}
+
+/* Write out the queued messages and return to writing at once */
+void PoeLogger::stop() {
+    if (!running.load()) {
+        return;
+    }
+    running.store(false, std::memory_order_release);
+    stopping.store(true, std::memory_order_release);
+    drain_thread.join();
+
+    /* Messages pushed while the thread was stopping */
+    lock_guard<mutex> guard(output_lock);
+    LogRecord record;
+    while (pop(record)) {
+        output(record, monotonicUs());
+    }
+    flushRepeats();
 }
@@ -19,32 +19,74 @@
 #include "clipp.h"
 #include "poe_controller.h"
 #include "main_utils.h"
+#include "metrics.h"
+#include "poe_scenario.h"
+#include "poe_clock.h"
+#include "poed_config.h"
+#include "poe_checkpoint.h"
+#include "poe_shm.h"
 #include <nlohmann/json.hpp>
 #include <unistd.h>
+#include <cerrno>
+#include <cstring>
 #include <thread>
 #include <iostream>
+#include <sstream>
 
 
 bool test_mode = false;
 
 static void daemonize();
+static int printPoeData(string socket_path, bool pretty);
 
 int main(int argc, char *argv[]) {
     /* Parse command line arguments */
     vector<string> wrong;
     bool show_help = false;
     bool get_data_flag = false;
+    bool pretty_flag = false;
     bool daemonize_flag = false;
     int monitor_period_us = 1000000;
+    long sim_seed = -1;
+    string sim_scenario_path;
+    bool time_warp = false;
+    long sim_duration_s = 0;
+    string sim_topology;
+    string socket_path_arg;
+    string state_path;
+    string shm_name;
 
     auto cli = (
             clipp::option("-p", "--monitor-period") &
             clipp::value("PoE ports monitoring period in us (default 1000000 us)", monitor_period_us),
             clipp::option("-t").set(test_mode).doc("Enable test mode that emulates PoE ports data"),
+            clipp::option("--seed") &
+            clipp::value("Seed of the emulated PoE ports data in test mode (default is random)", sim_seed),
+            clipp::option("--sim-scenario") &
+            clipp::value("JSON file with load profiles of the emulated PoE ports in test mode", sim_scenario_path),
+            clipp::option("--sim-topology") &
+            clipp::value("Generate <controllers>x<ports> emulated PoE ports in test mode instead of the "
+                         "configured ones, i.e. 100x48", sim_topology),
+            clipp::option("--time-warp").set(time_warp).doc("Run test mode on virtual time without sleeping "
+                                                           "between monitoring periods"),
+            clipp::option("--sim-duration") &
+            clipp::value("Stop test mode after the time in seconds and print statistics to stdout",
+                         sim_duration_s),
+            clipp::option("--state-file") &
+            clipp::value("File keeping the budget decisions across restarts (default " POED_STATE_FILE
+                         ", none in test mode)", state_path),
+            clipp::option("--shm") &
+            clipp::value("POSIX shared memory name of the published ports snapshot (default " POED_SHM_NAME
+                         ", none in test mode)", shm_name),
             clipp::option("-d").set(daemonize_flag).doc("Run in background as a daemon"),
             clipp::option("-g", "--get-all").set(get_data_flag).doc("Print all PoE data to stdout in "
                                                                 "JSON format. The daemon must be "
                                                                 "running to have this option workable"),
+            clipp::option("--pretty").set(pretty_flag).doc("Indent the JSON printed by '--get-all', it is printed "
+                                                           "once the whole response is received"),
+            clipp::option("-s", "--socket") &
+            clipp::value("Unix socket path used with '--get-all' (default is taken from the running daemon)",
+                         socket_path_arg),
             clipp::option("-h", "--help").set(show_help).doc("Show help information"),
             clipp::any_other(wrong)
     );
@@ -55,11 +97,25 @@ int main(int argc, char *argv[]) {
             return 0;
         }
 
+        if (get_data_flag) {
+            /* Client mode, go straight to the socket without config and logs initialization */
+            return printPoeData(socket_path_arg, pretty_flag);
+        }
+
+        if ((time_warp || sim_duration_s != 0 || !sim_topology.empty()) && !test_mode) {
+            cout << "'--time-warp', '--sim-duration' and '--sim-topology' work in test mode only\n";
+            return -1;
+        }
+        if (sim_duration_s < 0) {
+            cout << "'--sim-duration' must be positive\n";
+            return -1;
+        }
+
         if (daemonize_flag) {
             daemonize();
         }
 
-        if (!get_data_flag) cout << "PoE daemon started, with monitor period: " << monitor_period_us << " us" << endl;
+        cout << "PoE daemon started, with monitor period: " << monitor_period_us << " us" << endl;
         if (test_mode) {
             syslog(LOG_INFO, "Test mode enabled\n");
         }
@@ -86,141 +142,205 @@ int main(int argc, char *argv[]) {
         syslog(LOG_ERR, "Configuration import error\n");
     }
 
-    if (test_mode) {
-        syslog(LOG_INFO, "PoE daemon working in test mode, skip UCI config validation\n");
-    } else {
-        /* Check config */
-        if (!validateUciConfig(config)) {
-            syslog(LOG_ERR, "Configuration is not valid\n");
-            return -1;
-        }
+    /* Compile the config into typed structures, the hardware is checked out of test mode only */
+    PoedConfig poed_config;
+    if (!poed_config.compile(config, !test_mode)) {
+        syslog(LOG_ERR, "Configuration is not valid\n");
+        return -1;
     }
 
-    auto sections = config.getSections();
-
-    /* Get unix socket server options */
-    string unix_socket_enable = sections["general"].at(0).options["unix_socket_enable"];
-    string unix_socket_path = sections["general"].at(0).options["unix_socket_path"];
-
     /* Reinitialize logger with proper log level */
-    string log_level_str = sections["general"].at(0).options["log_level"];
-    int log_level = get_syslog_level(log_level_str);
+    int log_level = get_syslog_level(poed_config.log_level);
 
     closelog();
     initialize_logging(config_name, log_level);
 
-    /* Check if the daemon is already running */
-    bool procd_found_flag = false;
-    vector<pid_t> procd_pids = getProcessIdsByName("procd");
-    if (procd_pids.empty()) {
-        syslog(LOG_INFO, "procd pid wasn't found\n");
-    } else {
-        syslog(LOG_INFO, "procd pid: %d\n", procd_pids.at(0));
-        procd_found_flag = true;
+    if (test_mode) {
+        /* Seed the simulation once, before any port draws from it, so a run can be replayed */
+        uint32_t seed = sim_seed >= 0 ? static_cast<uint32_t>(sim_seed) : random_device()();
+        PoeSimProfile::seed(seed);
+        syslog(LOG_INFO, "Simulation seed %u, use '--seed %u' to replay the run\n", seed, seed);
     }
 
-    vector<pid_t> pids = getProcessIdsByName("poed");
-    bool procd_found_as_ppid = false;
-    syslog(LOG_DEBUG, "Detected poed pids:\n");
-    for (auto pid: pids) {
-        pid_t ppid = getppid();
-        if (procd_found_flag && ppid == procd_pids.at(0)) {
-            procd_found_as_ppid = true;
+    if (test_mode && !sim_topology.empty() && !generateSimTopology(sim_topology, poed_config)) {
+        return -1;
+    }
+
+    static VirtualClock virtual_clock;
+    if (time_warp) {
+        poe_clock = &virtual_clock;
+        syslog(LOG_INFO, "Time warp enabled, monitoring periods pass without sleeping\n");
+    }
+
+    PoeScenario scenario;
+    bool scenario_loaded = false;
+    if (test_mode && !sim_scenario_path.empty()) {
+        if (!scenario.load(sim_scenario_path)) {
+            syslog(LOG_ERR, "Can't load simulation scenario %s\n", sim_scenario_path.c_str());
+            return -1;
         }
-        syslog(LOG_DEBUG, "pid: %d, ppid: %d, ppid name: %s\n", pid, ppid, getProcessName(ppid).c_str());
+        scenario_loaded = true;
     }
 
-    syslog(LOG_DEBUG, "Check if the daemon is already running\n");
-    if (!pids.empty() && !procd_found_as_ppid) {
-        /* Check if new process was started with -g flag */
-        syslog(LOG_DEBUG, "%zu running instance(s) found in the processes\n", pids.size());
-        if (get_data_flag) {
-            syslog(LOG_DEBUG, "This instance started with flag '--get-all'\n");
-            if (unix_socket_enable != "1") {
-                syslog(LOG_ERR, "Using of unix socket server is disabled in config file, exiting\n");
-                cerr << "Using of unix socket server is disabled in config file, exiting\n";
-                return -1;
-            }
-            nlohmann::json msg = {
-                    {"msg_type", "request"},
-                    {"data", "get_all"}
-            };
-
-            string response = requestFromUnixSocket(unix_socket_path, msg.dump(4), 2000);
-            syslog(LOG_DEBUG, "Requested data result: %s\n", response.c_str());
-            cout << response << "\n";
-            return 0;
-        } else {
+    /* Check if the daemon is already running,
+     * the lock is held until the process exits, so a crashed instance never blocks the restart */
+    int pid_fd = lockPidFile(POED_PID_FILE, poed_config.unix_socket_enable ? poed_config.unix_socket_path : "");
+    if (pid_fd < 0) {
+        if (errno == EWOULDBLOCK) {
             syslog(LOG_ERR, "Attempt to start the instance of the daemon while it's already working\n");
             cerr << "Attempt to start the instance of the daemon while it's already working\n";
-            return -1;
+        } else {
+            syslog(LOG_ERR, "Can't lock pid file %s: %s\n", POED_PID_FILE, strerror(errno));
+            cerr << "Can't lock pid file " << POED_PID_FILE << ": " << strerror(errno) << "\n";
         }
-    }
-    if (get_data_flag) {
-        syslog(LOG_ERR, "Running instance of daemon was not found, start it before request PoE data\n");
-        cerr << "Running instance of daemon was not found, start it before request PoE data\n";
         return -1;
     }
 
 //    cout << "Imported config:\n";
 //    config.dump();
 
-    syslog(LOG_INFO, "Daemon started with log level: %s", log_level_str.c_str());
-
-    /* Parse uci config class into binary poe structures */
-    syslog(LOG_INFO, "Parse UCI config into binary structures\n");
-    int contr_ind = 0;
-    vector<PoeController> controllers;
-    for (auto& controller: sections["controller"]) {
-        /* Get controller properties */
-        PoeController c;
-        c.path = controller.options["path"];
-        c.total_budget = stod(controller.options["total_power_budget"]);
-        c.ports.resize(stoi(controller.options["ports"]));
-
-        /* Fill controller's ports vector with corresponded ports */
-        for (auto port: sections["port"]) {
-            if (stoi(port.options["controller"]) == contr_ind) {
-                PoePort p;
-                p.contr_path = c.path;
-                p.name = port.options["name"];
-                p.index = stoi(port.options["port_number"]);
-                p.budget = stod(port.options["power_budget"]);
-                p.priority = stoi(port.options["priority"]);
-
-                /* Set system test mode flag to port */
-                p.test_mode = test_mode;
-
-                /* Set current port with corresponded mode */
-                if (!p.setMode(parsePoeMode(port.options["mode"]))) {
-                    syslog(LOG_ERR, "Can't set mode %s to port %d, of controller %s\n",
-                           port.options["mode"].c_str(), p.index, p.contr_path.c_str());
-                    return -1;
-                }
-
-                p.initSim();
-
-                c.ports.at(p.index) = p;
+    syslog(LOG_INFO, "Daemon started with log level: %s", poed_config.log_level.c_str());
+
+    if (state_path.empty() && !test_mode) {
+        state_path = POED_STATE_FILE;
+    }
+    if (shm_name.empty() && !test_mode) {
+        shm_name = POED_SHM_NAME;
+    }
+
+    /* Build the controllers of the compiled config */
+    vector<PoeController> controllers(poed_config.controllers.size());
+    vector<bool> hw_states_read(controllers.size(), false);
+    for (size_t contr_ind = 0; contr_ind < controllers.size(); contr_ind++) {
+        const ControllerConfig& controller = poed_config.controllers[contr_ind];
+        PoeController& c = controllers[contr_ind];
+        c.path = controller.path;
+        c.total_budget = controller.total_budget;
+        c.resizePorts(controller.ports_num);
+        c.telemetry.hysteresis.assign(controller.ports_num, controller.hysteresis);
+
+        /* Fill controller's ports with corresponded ports */
+        for (size_t index = 0; index < controller.ports_num; index++) {
+            if (controller.ports[index] == POED_CONFIG_NO_PORT) {
+                continue;
+            }
+            const PortConfig& port = poed_config.ports[controller.ports[index]];
+            PoePort& p = c.ports[index];
+            p.name = port.name;
+            c.telemetry.budget[index] = port.budget;
+            c.telemetry.priority[index] = port.priority;
+            if (port.hysteresis >= 0.0) {
+                c.telemetry.hysteresis[index] = port.hysteresis;
             }
+
+            /* Set system test mode flag to port */
+            p.test_mode = test_mode;
+        }
+
+        /* Read current state of all the ports at once to keep the ports that already run configured mode */
+        hw_states_read[contr_ind] = !test_mode && c.getPortsData();
+        if (!test_mode && !hw_states_read[contr_ind]) {
+            syslog(LOG_WARNING, "Can't read ports state of controller %s, reinitialize its ports\n",
+                   c.path.c_str());
         }
-        controllers.push_back(c);
-        contr_ind++;
     }
 
+    /* Ports shed before the restart must stay off, restore the budget decisions before powering any port */
+    if (!state_path.empty()) {
+        PoeCheckpoint::load(state_path, controllers);
+    }
+
+    for (size_t contr_ind = 0; contr_ind < controllers.size(); contr_ind++) {
+        const ControllerConfig& controller = poed_config.controllers[contr_ind];
+        PoeController& c = controllers[contr_ind];
+        bool hw_state_read = hw_states_read[contr_ind];
+        for (size_t index = 0; index < controller.ports_num; index++) {
+            if (controller.ports[index] == POED_CONFIG_NO_PORT) {
+                continue;
+            }
+
+            /* Ports not covered by the scenario get the default random profiles */
+            PoeMode mode = poed_config.ports[controller.ports[index]].mode;
+            PoePort& p = c.ports[index];
+            if (!scenario_loaded || !scenario.apply(p, mode)) {
+                p.initSim(mode);
+            }
+
+            /* Set current port with corresponded mode */
+            bool shed = c.telemetry.hasFlag(index, POE_PORT_OVERBUDGET);
+            bool mode_set = hw_state_read ? c.adoptPortMode(index, mode) : c.setPortMode(index, mode, !shed);
+            if (!mode_set) {
+                syslog(LOG_ERR, "Can't set mode %s to port %zu, of controller %s\n",
+                       poeModeToString(mode).c_str(), index, c.path.c_str());
+                return -1;
+            }
+        }
+    }
+
+    if (!state_path.empty()) {
+        poe_checkpoint.open(state_path, controllers);
+    }
+    if (!shm_name.empty()) {
+        poe_shm.open(shm_name, controllers);
+    }
+
+    /* From now on the messages are written by the drain thread, the control loop never waits for syslog */
+    poe_logger.start();
+
     /* Controlling budgets */
-    thread budgetThread(controlBudgetsWithSleep, std::ref(controllers), monitor_period_us);
-    if (unix_socket_enable == "1") {
-        thread unixSocketServerThread(handleUnixSocketServer, unix_socket_path, std::ref(controllers));
-        unixSocketServerThread.join();
+    thread budgetThread(controlBudgetsWithSleep, std::ref(controllers), monitor_period_us,
+                        (uint64_t)sim_duration_s * 1000000);
+    if (poed_config.metrics_http_port != 0) {
+        thread metricsThread(handleMetricsHttpServer, poed_config.metrics_http_port);
+        metricsThread.detach();
     }
+    if (poed_config.unix_socket_enable) {
+        thread unixSocketServerThread(handleUnixSocketServer, poed_config.unix_socket_path, std::ref(controllers));
+        unixSocketServerThread.detach();
+    }
+
+    /* The daemon lives as long as the control loop does */
     budgetThread.join();
 
+    if (sim_duration_s > 0) {
+        cout << getJsonStats(controllers).dump(4) << endl;
+    }
+
+    poe_shm.close();
+    poe_logger.stop();
     syslog(LOG_INFO, "Daemon is shutting down");
     closelog();
 
     return 0;
 }
 
+/* The response is copied to stdout as it arrives, only the indented one is buffered to be parsed */
+static int printPoeData(string socket_path, bool pretty) {
+    if (socket_path.empty()) {
+        socket_path = getPidFileSocketPath(POED_PID_FILE);
+    }
+    if (socket_path.empty()) {
+        socket_path = POED_DEFAULT_SOCKET_PATH;
+    }
+
+    nlohmann::json msg = {
+            {"msg_type", "request"},
+            {"data", "get_all"}
+    };
+
+    string error_msg;
+    ostringstream response;
+    if (!streamFromUnixSocket(socket_path, msg.dump(), 2000, pretty ? (ostream&)response : cout, error_msg)) {
+        cerr << error_msg << ", make sure the daemon is running with unix socket server enabled\n";
+        return -1;
+    }
+    if (pretty) {
+        nlohmann::json j_response = nlohmann::json::parse(response.str(), nullptr, false);
+        cout << (j_response.is_discarded() ? response.str() : j_response.dump(4) + "\n");
+    }
+    return 0;
+}
+
 static void daemonize() {
     /* Fork off the parent process */
     pid_t pid = fork();
@@ -18,163 +18,960 @@
 #include "logs.h"
 #include "poe_controller.h"
 #include "poe_simulator.h"
+#include "metrics.h"
+#include "stats.h"
+#include "poe_clock.h"
+#include "poe_checkpoint.h"
+#include "poe_events.h"
+#include "poe_shm.h"
+#include "poe_commands.h"
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <poll.h>
 #include <nlohmann/json.hpp>
 #include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <condition_variable>
+#include <mutex>
+#include <sstream>
+#include <thread>
 
-void controlBudgetsWithSleep(vector<PoeController>& controllers, int sleep_time_us) {
-    while (controlBudgets(controllers) >= 0) {
-        /* Sleep for some time */
-        usleep(sleep_time_us);
+/* Guards the state of the controllers between the control loop, which changes it, and the socket handlers,
+ * which read it. The loop takes it per controller after the driver read, so the reads and the sleep are outside
+ */
+static mutex controllers_lock;
+
+/* Run the control loop, forever unless the duration of the run is given */
+void controlBudgetsWithSleep(vector<PoeController>& controllers, int sleep_time_us, uint64_t duration_us) {
+    uint64_t run_start = poe_clock->nowUs();
+    /* The commands wait for the next cycle, give them two periods */
+    poe_commands.setTimeout(max((uint64_t)POE_COMMAND_TIMEOUT_US, 2 * (uint64_t)sleep_time_us));
+    for (;;) {
+        uint64_t cycle_start = monotonicUs();
+        uint64_t cycle_cpu_start = threadCpuTimeUs();
+        /* Runtime changes of the socket take effect at the cycle boundary */
+        {
+            lock_guard<mutex> guard(controllers_lock);
+            poe_commands.apply(controllers);
+        }
+        controlBudgets(controllers);
+        uint64_t cycle_time_us = monotonicUs() - cycle_start;
+        uint64_t cycle_cpu_us = threadCpuTimeUs() - cycle_cpu_start;
+
+        poe_stats.cycles.add();
+        poe_stats.last_cycle_us.set(cycle_time_us);
+        poe_stats.cycle.add(cycle_time_us);
+        poe_stats.off_cpu.add(cycle_time_us > cycle_cpu_us ? cycle_time_us - cycle_cpu_us : 0);
+        if (cycle_time_us > (uint64_t)sleep_time_us) {
+            poe_stats.overruns.add();
+        }
+
+        /* Persist the budget decisions of the cycle, if any, and the energy counters from time to time */
+        poe_checkpoint.saveIfChanged(controllers, poe_clock->nowUs());
+
+        /* Render metrics once per cycle, scrapers only copy the ready text */
+        poe_metrics.render(controllers, poe_stats);
+        poe_shm.publish(controllers, poe_stats.cycles.get());
+
+        /* Sleep for some time, the virtual clock only advances the time */
+        uint64_t sleep_start = monotonicUs();
+        poe_clock->sleepUs(sleep_time_us);
+        uint64_t slept_us = monotonicUs() - sleep_start;
+        if (!poe_clock->isVirtual()) {
+            poe_stats.wakeup_delay.add(slept_us > (uint64_t)sleep_time_us ? slept_us - sleep_time_us : 0);
+        }
+        poe_stats.uptime_us.set(poe_clock->nowUs() - run_start);
+
+        if (duration_us > 0 && poe_stats.uptime_us.get() >= duration_us) {
+            POE_LOG(GENERAL, LOG_INFO, "Run duration of %llu s is over\n", (unsigned long long)(duration_us / 1000000));
+            break;
+        }
+    }
+}
+
+/* Power the port on or off accounting the time to the actuation phase */
+static bool actuatePort(PoeController& controller, size_t port, bool power_on, uint64_t& actuate_us) {
+    uint64_t start = monotonicUs();
+    bool result = power_on ? controller.powerOn(port) : controller.powerOff(port);
+    actuate_us += monotonicUs() - start;
+    return result;
+}
+
+/* A shed soon after the restore of the port is a flap, the next restore waits for the backoff,
+ * which doubles with every flap in a row and starts over once the port stays powered through the window
+ */
+static void dampFlap(PoeController& controller, size_t contr_ind, size_t port, uint64_t now_us) {
+    PoePort& p = controller.ports[port];
+    if (p.last_restore_us == 0 || now_us - p.last_restore_us > POE_FLAP_WINDOW_US) {
+        p.restore_backoff_us = 0;
+        return;
     }
+    p.flap_cnt++;
+    p.restore_backoff_us = p.restore_backoff_us == 0 ? POE_FLAP_BACKOFF_MIN_US :
+                           min(p.restore_backoff_us * 2, (uint64_t)POE_FLAP_BACKOFF_MAX_US);
+    p.next_restore_us = now_us + p.restore_backoff_us;
+    controller.stats.flaps.add();
+    poe_events.push(PoeEventKind::FLAP, contr_ind, port, controller.telemetry.power[port],
+                    controller.telemetry.budget[port], controller.getTotalPower());
+    POE_LOG(BUDGET, LOG_NOTICE, "Port %zu of controller %s flaps, restore is delayed by %llu s\n",
+            port, controller.path.c_str(), (unsigned long long)(p.restore_backoff_us / 1000000));
 }
 
+static void setControllerHealth(PoeController& controller, size_t contr_ind, ControllerHealth health) {
+    if (controller.health == health) {
+        return;
+    }
+    int priority = health == ControllerHealth::OK ? LOG_NOTICE : (health == ControllerHealth::FAILED ? LOG_ERR : LOG_WARNING);
+    POE_LOG(HARDWARE, priority, "Controller %zu %s is %s, was %s\n", contr_ind, controller.path.c_str(),
+            controllerHealthToString(health), controllerHealthToString(controller.health));
+    controller.health = health;
+}
+
+/* A failed read, or one which missed its deadline, skips the controller for the cycle. The first failures
+ * in a row only degrade it and it is retried on the next cycle, then it is failed and retried with a backoff
+ * doubling up to the maximum
+ */
+static void failController(PoeController& controller, size_t contr_ind, uint64_t now_us) {
+    controller.stats.failed_reads.add();
+    poe_events.push(PoeEventKind::READ_FAULT, contr_ind, POE_EVENT_NO_PORT, 0.0, controller.total_budget, 0.0);
+    POE_LOG(HARDWARE, LOG_ERR, "Can't acquire ports data of controller %s\n", controller.path.c_str());
+
+    controller.failures++;
+    if (controller.failures < POE_CONTROLLER_FAILURES_MAX) {
+        setControllerHealth(controller, contr_ind, ControllerHealth::DEGRADED);
+        return;
+    }
+    controller.retry_backoff_us = controller.health != ControllerHealth::FAILED ? POE_CONTROLLER_RETRY_MIN_US :
+                                  min(controller.retry_backoff_us * 2, (uint64_t)POE_CONTROLLER_RETRY_MAX_US);
+    controller.retry_us = now_us + controller.retry_backoff_us;
+    setControllerHealth(controller, contr_ind, ControllerHealth::FAILED);
+}
+
+/* Enforce the budgets of every controller once, returns the number of controllers that aren't ok */
 int controlBudgets(vector<PoeController>& controllers) {
-    for (PoeController& controller: controllers) {
-        if (!controller.getPortsData()) {
-            syslog(LOG_ERR, "Can't acquire ports data\n");
-            return -1;
+    int not_ok = 0;
+
+    /* A failed controller waits for its retry, the others are enforced on schedule. The reads of all
+     * the controllers run at once and share the deadline, so a controller hung in the driver costs
+     * the cycle the deadline once and the ones after it are still enforced
+     */
+    uint64_t cycle_us = poe_clock->nowUs();
+    uint64_t read_deadline_us = monotonicUs() + POE_CONTROLLER_READ_TIMEOUT_US;
+    for (auto& controller: controllers) {
+        if (controller.health != ControllerHealth::FAILED || cycle_us >= controller.retry_us) {
+            controller.startReadPortsData();
+        }
+    }
+
+    for (size_t contr_ind = 0; contr_ind < controllers.size(); contr_ind++) {
+        PoeController& controller = controllers[contr_ind];
+        ControllerStats& stats = controller.stats;
+        PoePortsTelemetry& tm = controller.telemetry;
+        uint64_t read_start = monotonicUs();
+        uint64_t sample_us = poe_clock->nowUs();
+
+        if (controller.health == ControllerHealth::FAILED && cycle_us < controller.retry_us) {
+            not_ok++;
+            continue;
+        }
+        PoeReadResult read_result = controller.readPortsData(read_deadline_us);
+        lock_guard<mutex> guard(controllers_lock);
+        if (read_result != PoeReadResult::OK) {
+            failController(controller, contr_ind, sample_us);
+            not_ok++;
+            continue;
+        }
+        uint64_t parse_start = monotonicUs();
+        stats.phases[PHASE_READ].add(parse_start - read_start);
+        if (!controller.parsePortsData()) {
+            failController(controller, contr_ind, sample_us);
+            not_ok++;
+            continue;
         }
+        controller.accountEnergy(sample_us);
+        uint64_t decide_start = monotonicUs();
+        stats.phases[PHASE_PARSE].add(decide_start - parse_start);
+        uint64_t actuate_us = 0;
+        size_t ports_num = tm.size();
+        size_t failed_writes = 0;
 
         /* Check ports budgets */
         double total_power = 0.0;
-        for (auto& port: controller.ports) {
-            if (port.power > port.budget) {
-                syslog(LOG_INFO, "Port %d of controller %s has overbudget: %.2lf W, while %.2lf W is max. Turn off.\n",
-                       port.index, port.contr_path.c_str(), port.power, port.budget);
-                port.overbudget_flag = true;
-                if (!port.powerOff()) {
-                    syslog(LOG_ERR, "Can't power off PoE port %d of controller %s\n",
-                           port.index, port.contr_path.c_str());
-                    return -1;
+        for (size_t i = 0; i < ports_num; i++) {
+            if (tm.power[i] > tm.budget[i]) {
+                POE_LOG(BUDGET, LOG_INFO, "Port %zu of controller %s has overbudget: %.2lf W, while %.2lf W is max. Turn off.\n",
+                        i, controller.path.c_str(), tm.power[i], tm.budget[i]);
+                tm.setFlag(i, POE_PORT_OVERBUDGET, true);
+                controller.ports[i].shed_cnt++;
+                stats.sheds.add();
+                poe_events.push(PoeEventKind::SHED_PORT_BUDGET, contr_ind, i, tm.power[i], tm.budget[i],
+                                controller.getTotalPower());
+                dampFlap(controller, contr_ind, i, sample_us);
+                if (!actuatePort(controller, i, false, actuate_us)) {
+                    poe_events.push(PoeEventKind::ACTUATE_FAULT, contr_ind, i, tm.power[i], tm.budget[i],
+                                    controller.getTotalPower());
+                    POE_LOG(HARDWARE, LOG_ERR, "Can't power off PoE port %zu of controller %s\n",
+                            i, controller.path.c_str());
+                    /* The port still draws the power, the next cycle retries */
+                    failed_writes++;
+                    total_power += tm.power[i];
                 }
                 continue;
             }
-            total_power += port.power;
+            total_power += tm.power[i];
         }
         if (total_power > controller.total_budget) {
             /* Handle overbudget */
-            syslog(LOG_INFO, "Ports of controller %s has overbudget: %.2lf, while %.2lf is max\n",
-                   controller.path.c_str(), total_power, controller.total_budget);
+            POE_LOG(BUDGET, LOG_INFO, "Ports of controller %s has overbudget: %.2lf, while %.2lf is max\n",
+                    controller.path.c_str(), total_power, controller.total_budget);
             /* Turn off port with the lowest priority */
-            PoePort lowest_prio_port = controller.getLowesPrioPort();
-            syslog(LOG_INFO, "Port %d of controller %s has the lowest priority, turn it off\n",
-                   lowest_prio_port.index, controller.path.c_str());
-            lowest_prio_port.enable_perm = false;
-            lowest_prio_port.overbudget_flag = true;
-            if (!lowest_prio_port.powerOff()) {
-                syslog(LOG_ERR, "Can't power off PoE port %d of controller %s\n",
-                       lowest_prio_port.index, lowest_prio_port.contr_path.c_str());
-                return -1;
+            size_t lowest_prio_port = controller.getLowesPrioPort();
+            POE_LOG(BUDGET, LOG_INFO, "Port %zu of controller %s has the lowest priority, turn it off\n",
+                    lowest_prio_port, controller.path.c_str());
+            tm.setFlag(lowest_prio_port, POE_PORT_ENABLE_PERM, false);
+            tm.setFlag(lowest_prio_port, POE_PORT_OVERBUDGET, true);
+            controller.ports[lowest_prio_port].shed_cnt++;
+            stats.sheds.add();
+            poe_events.push(PoeEventKind::SHED_TOTAL_BUDGET, contr_ind, lowest_prio_port,
+                            tm.power[lowest_prio_port], controller.total_budget, total_power);
+            dampFlap(controller, contr_ind, lowest_prio_port, sample_us);
+            if (!actuatePort(controller, lowest_prio_port, false, actuate_us)) {
+                poe_events.push(PoeEventKind::ACTUATE_FAULT, contr_ind, lowest_prio_port,
+                                tm.power[lowest_prio_port], controller.total_budget, total_power);
+                POE_LOG(HARDWARE, LOG_ERR, "Can't power off PoE port %zu of controller %s\n",
+                        lowest_prio_port, controller.path.c_str());
+                failed_writes++;
             }
-        } else if (total_power + POE_PWR_HYSTERESIS <= controller.total_budget) {
-            /* Mark overbudget ports as permitted to enable */
-            vector<PoePort*> overbudget_ports;
-            for (auto& port: controller.ports) {
-                if (port.state == PoeState::OPEN) {
-                    if (port.overbudget_flag) {
-                        port.enable_perm = true;
-                    }
-                } else {
-                    if (port.overbudget_flag && port.enable_perm) {
-                        overbudget_ports.push_back(&port);
-                    }
-                }
-            }
-            /* Check if some ports can be enabled, enable only 1 per cycle with highest prio */
+        } else {
+            /* Mark overbudget ports as permitted to enable,
+             * and check if some ports can be enabled, enable only 1 per cycle with highest prio.
+             * The controller must have the hysteresis of the port spare and the port must be out of its backoff
+             */
             int max_prio = INT32_MAX;
             int max_prio_ind = -1;
-            int ind_cnt = 0;
-            for (const auto& port: overbudget_ports) {
-                if (port->priority < max_prio) {
-                    max_prio = port->priority;
-                    max_prio_ind = ind_cnt;
+            for (size_t i = 0; i < ports_num; i++) {
+                if (!tm.hasFlag(i, POE_PORT_OVERBUDGET) || total_power + tm.hysteresis[i] > controller.total_budget) {
+                    continue;
+                }
+                if (tm.state[i] == (uint8_t)PoeState::OPEN) {
+                    tm.setFlag(i, POE_PORT_ENABLE_PERM, true);
+                } else if (tm.hasFlag(i, POE_PORT_ENABLE_PERM) && tm.priority[i] < max_prio &&
+                        sample_us >= controller.ports[i].next_restore_us) {
+                    max_prio = tm.priority[i];
+                    max_prio_ind = i;
                 }
-                ind_cnt++;
             }
             if (max_prio_ind >= 0) {
-                syslog(LOG_INFO, "Enable %d port of controller %s\n",
-                       overbudget_ports.at(max_prio_ind)->index,
-                       overbudget_ports.at(max_prio_ind)->contr_path.c_str());
-                if (!overbudget_ports.at(max_prio_ind)->powerOn()) {
-                    syslog(LOG_ERR, "Can't power on PoE port %d of controller %s\n",
-                           overbudget_ports.at(max_prio_ind)->index,
-                           overbudget_ports.at(max_prio_ind)->contr_path.c_str());
-                    return -1;
+                POE_LOG(BUDGET, LOG_INFO, "Enable %d port of controller %s\n", max_prio_ind, controller.path.c_str());
+                if (!actuatePort(controller, max_prio_ind, true, actuate_us)) {
+                    poe_events.push(PoeEventKind::ACTUATE_FAULT, contr_ind, max_prio_ind, tm.power[max_prio_ind],
+                                    controller.total_budget, total_power);
+                    POE_LOG(HARDWARE, LOG_ERR, "Can't power on PoE port %d of controller %s\n",
+                            max_prio_ind, controller.path.c_str());
+                    failed_writes++;
+                } else {
+                    tm.setFlag(max_prio_ind, POE_PORT_OVERBUDGET, false);
+                    controller.ports[max_prio_ind].restore_cnt++;
+                    controller.ports[max_prio_ind].last_restore_us = sample_us;
+                    stats.restores.add();
+                    poe_events.push(PoeEventKind::RESTORE, contr_ind, max_prio_ind, tm.power[max_prio_ind],
+                                    controller.total_budget, total_power);
                 }
-                overbudget_ports.at(max_prio_ind)->overbudget_flag = false;
             }
         }
 
         /* Workaround for turning on PoE ports in manual mode that turns off without load */
-        for (auto& port: controller.ports) {
-            if (port.enable_flag &&
-                (port.mode == PoeMode::POE_48V || port.mode == PoeMode::POE_24V)) {
-                if (!port.powerOn()) {
-                    syslog(LOG_ERR, "Can't power on PoE port %d of controller %s\n",
-                           port.index, port.contr_path.c_str());
-                    return -1;
+        for (size_t i = 0; i < ports_num; i++) {
+            if (tm.hasFlag(i, POE_PORT_ENABLED) &&
+                (tm.mode[i] == (uint8_t)PoeMode::POE_48V || tm.mode[i] == (uint8_t)PoeMode::POE_24V)) {
+                if (!actuatePort(controller, i, true, actuate_us)) {
+                    poe_events.push(PoeEventKind::ACTUATE_FAULT, contr_ind, i, tm.power[i], tm.budget[i],
+                                    controller.getTotalPower());
+                    POE_LOG(HARDWARE, LOG_ERR, "Can't power on PoE port %zu of controller %s\n",
+                            i, controller.path.c_str());
+                    failed_writes++;
                 }
             }
         }
+
+        uint64_t decide_us = monotonicUs() - decide_start;
+        stats.phases[PHASE_DECIDE].add(decide_us - actuate_us);
+        stats.phases[PHASE_ACTUATE].add(actuate_us);
+
+        /* Failed writes are scoped to their ports, the controller is degraded until a clean cycle */
+        stats.failed_writes.add(failed_writes);
+        setControllerHealth(controller, contr_ind, failed_writes > 0 ? ControllerHealth::DEGRADED : ControllerHealth::OK);
+        controller.failures = 0;
+        if (controller.health != ControllerHealth::OK) {
+            not_ok++;
+        }
     }
-    return 0;
+    return not_ok;
 }
 
-nlohmann::json getJsonFromControllers(vector<PoeController>& controllers) {
+static const vector<string> controller_fields = {"total_budget", "total_power", "health", "ports"};
+
+static void addAllPortFields(FieldsProjection& projection) {
+    for (size_t i = 0; i < (size_t)PoePortField::COUNT; i++) {
+        if (poe_port_fields[i].json) {
+            projection.port_fields.push_back((PoePortField)i);
+        }
+    }
+}
+
+/* Resolve requested field names into the projection, empty field list selects everything */
+bool parseFieldsProjection(const vector<string>& fields, FieldsProjection& projection, string& error_msg) {
+    projection = FieldsProjection();
+    if (fields.empty()) {
+        addAllPortFields(projection);
+        projection.total_budget = projection.total_power = projection.health = projection.ports = true;
+        return true;
+    }
+
+    for (const auto& field: fields) {
+        PoePortField port_field;
+        if (findPortField(field, port_field) && poe_port_fields[(size_t)port_field].json) {
+            projection.port_fields.push_back(port_field);
+            projection.ports = true;
+        } else if (field == controller_fields[0]) {
+            projection.total_budget = true;
+        } else if (field == controller_fields[1]) {
+            projection.total_power = true;
+        } else if (field == controller_fields[2]) {
+            projection.health = true;
+        } else if (field == controller_fields[3]) {
+            projection.ports = true;
+        } else {
+            error_msg = "Unknown field '" + field + "'";
+            return false;
+        }
+    }
+
+    /* Plain "ports" selects all the port fields */
+    if (projection.ports && projection.port_fields.empty()) {
+        addAllPortFields(projection);
+    }
+    return true;
+}
+
+nlohmann::json getJsonFromPort(const PoeController& controller, size_t port, const FieldsProjection& projection) {
+    nlohmann::json j_port = nlohmann::json::object();
+    for (auto field: projection.port_fields) {
+        writePortFieldJson(field, j_port, controller, port);
+    }
+    return j_port;
+}
+
+nlohmann::json getJsonFromController(const PoeController& controller, const FieldsProjection& projection) {
+    nlohmann::json j_controller = nlohmann::json::object();
+
+    if (projection.total_budget) {
+        j_controller["total_budget"] = controller.total_budget;
+    }
+    if (projection.total_power) {
+        j_controller["total_power"] = controller.getTotalPower();
+    }
+    if (projection.health) {
+        j_controller["health"] = controllerHealthToString(controller.health);
+    }
+    if (projection.ports) {
+        nlohmann::json j_ports = nlohmann::json::array();
+        for (size_t i = 0; i < controller.ports.size(); i++) {
+            j_ports.push_back(getJsonFromPort(controller, i, projection));
+        }
+        j_controller["ports"] = std::move(j_ports);
+    }
+
+    return j_controller;
+}
+
+nlohmann::json getJsonFromControllers(vector<PoeController>& controllers, const FieldsProjection& projection) {
     nlohmann::json j_controllers = nlohmann::json::array();
 
     for (const auto& controller : controllers) {
-        nlohmann::json j_ports = nlohmann::json::array();
+        j_controllers.push_back(getJsonFromController(controller, projection));
+    }
 
-        double total_power = 0.0;
+    return j_controllers;
+}
 
-        for (const auto& port : controller.ports) {
-            total_power += port.power;
+nlohmann::json getJsonFromControllers(vector<PoeController>& controllers) {
+    FieldsProjection projection;
+    string error_msg;
+    parseFieldsProjection(vector<string>(), projection, error_msg);
+    return getJsonFromControllers(controllers, projection);
+}
 
-            nlohmann::json j_port = {
-                    {"name", port.name},
-                    {"index", port.index},
-                    {"priority", port.priority},
-                    {"voltage", port.voltage},
-                    {"current", port.current},
-                    {"power", port.power},
-                    {"budget", port.budget},
-                    {"state", port.state_str},
-                    {"mode", poeModeToString(port.mode)},
-                    {"load_class", port.load_type_str},
-                    {"enable_flag", port.enable_flag},
-                    {"overbudget_flag", port.overbudget_flag}
-            };
+static nlohmann::json getJsonFromHistogram(const LatencyHistogram& histogram) {
+    return nlohmann::json{
+            {"count", histogram.getCount()},
+            {"p50_us", histogram.getPercentile(50.0)},
+            {"p99_us", histogram.getPercentile(99.0)},
+            {"max_us", histogram.getMax()}
+    };
+}
 
-            j_ports.push_back(j_port);
+nlohmann::json getJsonStats(const vector<PoeController>& controllers) {
+    nlohmann::json j_controllers = nlohmann::json::array();
+    for (const auto& controller: controllers) {
+        nlohmann::json j_controller = {
+                {"path", controller.path},
+                {"failed_reads", controller.stats.failed_reads.get()},
+                {"sheds", controller.stats.sheds.get()},
+                {"restores", controller.stats.restores.get()},
+                {"flaps", controller.stats.flaps.get()},
+                {"health", controllerHealthToString(controller.health)},
+                {"failures", controller.failures},
+                {"failed_writes", controller.stats.failed_writes.get()}
+        };
+        for (int phase = 0; phase < PHASE_COUNT; phase++) {
+            j_controller[cyclePhaseToString((CyclePhase)phase)] =
+                    getJsonFromHistogram(controller.stats.phases[phase]);
         }
+        j_controllers.push_back(j_controller);
+    }
 
-        nlohmann::json j_controller = {
-                {"total_budget", controller.total_budget},
-                {"total_power", total_power},
-                {"ports", j_ports}
+    nlohmann::json j_process = nlohmann::json::object();
+    uint64_t rss_kb, user_us, system_us;
+    if (getProcessUsage(rss_kb, user_us, system_us)) {
+        j_process = {
+                {"rss_kb", rss_kb},
+                {"cpu_user_us", user_us},
+                {"cpu_system_us", system_us}
         };
+    }
 
-        j_controllers.push_back(j_controller);
+    return nlohmann::json{
+            {"cycles", poe_stats.cycles.get()},
+            {"uptime_us", poe_stats.uptime_us.get()},
+            {"time_warp", poe_clock->isVirtual()},
+            {"overruns", poe_stats.overruns.get()},
+            {"last_cycle_us", poe_stats.last_cycle_us.get()},
+            {"cycle", getJsonFromHistogram(poe_stats.cycle)},
+            {"off_cpu", getJsonFromHistogram(poe_stats.off_cpu)},
+            {"wakeup_delay", getJsonFromHistogram(poe_stats.wakeup_delay)},
+            {"commands", poe_stats.commands.get()},
+            {"command_latency", getJsonFromHistogram(poe_stats.command_latency)},
+            {"controllers", j_controllers},
+            {"process", j_process},
+            {"log", {
+                    {"written", poe_logger.written.get()},
+                    {"dropped", poe_logger.dropped.get()},
+                    {"collapsed", poe_logger.collapsed.get()},
+                    {"rate_limited", poe_logger.rate_limited_total.get()}
+            }}
+    };
+}
+
+PortNameIndex buildPortNameIndex(const vector<PoeController>& controllers) {
+    PortNameIndex index;
+    for (size_t c = 0; c < controllers.size(); c++) {
+        for (size_t p = 0; p < controllers[c].ports.size(); p++) {
+            const string& name = controllers[c].ports[p].name;
+            if (!name.empty()) {
+                index[name] = make_pair(c, p);
+            }
+        }
     }
+    return index;
+}
 
-    return j_controllers;
+static nlohmann::json makeResponse(nlohmann::json data, const string& error_msg) {
+    return nlohmann::json{
+            {"msg_type", "response"},
+            {"data", std::move(data)},
+            {"error_msg", error_msg}
+    };
+}
+
+/* Get optional "fields" list of the request */
+static bool getRequestProjection(const nlohmann::json& msg, FieldsProjection& projection, string& error_msg) {
+    vector<string> fields;
+    auto it = msg.find("fields");
+    if (it != msg.end()) {
+        if (!it->is_array()) {
+            error_msg = "Field 'fields' must be an array of strings";
+            return false;
+        }
+        for (const auto& field: *it) {
+            if (!field.is_string()) {
+                error_msg = "Field 'fields' must be an array of strings";
+                return false;
+            }
+            fields.push_back(field.get<string>());
+        }
+    }
+    return parseFieldsProjection(fields, projection, error_msg);
+}
+
+/* Get controller index of the request from the "controller" field */
+static bool getRequestController(const nlohmann::json& msg, const vector<PoeController>& controllers,
+                                 size_t& contr_ind, string& error_msg) {
+    auto it = msg.find("controller");
+    if (it == msg.end() || !it->is_number_unsigned()) {
+        error_msg = "Field 'controller' wasn't found";
+        return false;
+    }
+    contr_ind = it->get<size_t>();
+    if (contr_ind >= controllers.size()) {
+        error_msg = "Controller index is out of range";
+        return false;
+    }
+    return true;
+}
+
+/* Get the port of the request, addressed either by "name" or by "controller" and "index" */
+static bool getRequestPort(const nlohmann::json& msg, const vector<PoeController>& controllers,
+                           const PortNameIndex& port_index, size_t& contr_ind, size_t& port_ind, string& error_msg) {
+    auto name_it = msg.find("name");
+    if (name_it != msg.end() && name_it->is_string()) {
+        auto it = port_index.find(name_it->get<string>());
+        if (it == port_index.end()) {
+            error_msg = "Port wasn't found";
+            return false;
+        }
+        contr_ind = it->second.first;
+        port_ind = it->second.second;
+        return true;
+    }
+
+    if (!getRequestController(msg, controllers, contr_ind, error_msg)) {
+        error_msg = "Field 'name' or 'controller' and 'index' wasn't found";
+        return false;
+    }
+    auto index_it = msg.find("index");
+    if (index_it == msg.end() || !index_it->is_number_unsigned()) {
+        error_msg = "Field 'index' wasn't found";
+        return false;
+    }
+    port_ind = index_it->get<size_t>();
+    if (port_ind >= controllers[contr_ind].ports.size()) {
+        error_msg = "Port index is out of range";
+        return false;
+    }
+    return true;
+}
+
+static nlohmann::json handleGetPort(const nlohmann::json& msg, vector<PoeController>& controllers,
+                                    const PortNameIndex& port_index) {
+    FieldsProjection projection;
+    string error_msg;
+    size_t contr_ind;
+    size_t port_ind;
+    if (!getRequestProjection(msg, projection, error_msg) ||
+        !getRequestPort(msg, controllers, port_index, contr_ind, port_ind, error_msg)) {
+        return makeResponse("", error_msg);
+    }
+    lock_guard<mutex> guard(controllers_lock);
+    return makeResponse(getJsonFromPort(controllers[contr_ind], port_ind, projection), "");
+}
+
+static nlohmann::json handleGetController(const nlohmann::json& msg, vector<PoeController>& controllers,
+                                          const PortNameIndex&) {
+    FieldsProjection projection;
+    string error_msg;
+    size_t contr_ind;
+    if (!getRequestProjection(msg, projection, error_msg) ||
+        !getRequestController(msg, controllers, contr_ind, error_msg)) {
+        return makeResponse("", error_msg);
+    }
+    lock_guard<mutex> guard(controllers_lock);
+    return makeResponse(getJsonFromController(controllers[contr_ind], projection), "");
+}
+
+static nlohmann::json handleGetAll(const nlohmann::json& msg, vector<PoeController>& controllers,
+                                   const PortNameIndex&) {
+    FieldsProjection projection;
+    string error_msg;
+    if (!getRequestProjection(msg, projection, error_msg)) {
+        return makeResponse("", error_msg);
+    }
+    lock_guard<mutex> guard(controllers_lock);
+    return makeResponse(getJsonFromControllers(controllers, projection), "");
+}
+
+static nlohmann::json getJsonEnergy(uint64_t energy_uj) {
+    return nlohmann::json{
+            {"energy_uj", energy_uj},
+            {"energy_wh", energy_uj / 3.6e9}
+    };
+}
+
+/* Energy counters of one or all the controllers, "reset": true zeroes the returned counters,
+ * each counter is read and zeroed at once, so no energy of the running cycle is lost between the requests
+ */
+static nlohmann::json handleGetEnergy(const nlohmann::json& msg, vector<PoeController>& controllers,
+                                      const PortNameIndex&) {
+    string error_msg;
+    size_t first = 0;
+    size_t last = controllers.size();
+    if (msg.find("controller") != msg.end()) {
+        if (!getRequestController(msg, controllers, first, error_msg)) {
+            return makeResponse("", error_msg);
+        }
+        last = first + 1;
+    }
+    bool reset = false;
+    auto reset_it = msg.find("reset");
+    if (reset_it != msg.end()) {
+        if (!reset_it->is_boolean()) {
+            return makeResponse("", "Field 'reset' must be a boolean");
+        }
+        reset = reset_it->get<bool>();
+    }
+
+    lock_guard<mutex> guard(controllers_lock);
+    nlohmann::json j_controllers = nlohmann::json::array();
+    for (size_t c = first; c < last; c++) {
+        PoeController& controller = controllers[c];
+        nlohmann::json j_ports = nlohmann::json::array();
+        for (size_t i = 0; i < controller.ports.size(); i++) {
+            StatCounter& counter = controller.telemetry.energy_uj[i];
+            nlohmann::json j_port = getJsonEnergy(reset ? counter.take() : counter.get());
+            j_port["name"] = controller.ports[i].name;
+            j_port["index"] = controller.ports[i].index;
+            j_ports.push_back(std::move(j_port));
+        }
+        nlohmann::json j_controller = getJsonEnergy(reset ? controller.energy_uj.take() : controller.energy_uj.get());
+        j_controller["controller"] = c;
+        j_controller["ports"] = std::move(j_ports);
+        j_controllers.push_back(std::move(j_controller));
+    }
+    if (reset) {
+        /* Otherwise a restart within the energy period brings the old counters back */
+        poe_checkpoint.markDirty();
+    }
+    return makeResponse(j_controllers, "");
+}
+
+/* Events of the journal newer than the optional "since" sequence, oldest first */
+static nlohmann::json handleGetEvents(const nlohmann::json& msg, vector<PoeController>& controllers,
+                                      const PortNameIndex&) {
+    uint64_t since = 0;
+    auto since_it = msg.find("since");
+    if (since_it != msg.end()) {
+        if (!since_it->is_number_unsigned()) {
+            return makeResponse("", "Field 'since' must be an unsigned number");
+        }
+        since = since_it->get<uint64_t>();
+    }
+
+    vector<PoeEvent> events;
+    uint64_t dropped = 0;
+    uint64_t last_seq = poe_events.read(since, events, dropped);
+    nlohmann::json j_events = nlohmann::json::array();
+    for (const PoeEvent& event: events) {
+        nlohmann::json j_event = {
+                {"seq", event.seq},
+                {"time_us", event.time_us},
+                {"realtime_us", event.realtime_us},
+                {"kind", poeEventKindToString((PoeEventKind)event.kind)},
+                {"controller", event.controller},
+                {"power", event.power},
+                {"budget", event.budget},
+                {"total", event.total}
+        };
+        if (event.port != POE_EVENT_NO_PORT) {
+            j_event["port"] = event.port;
+            if (event.controller < controllers.size() && event.port < controllers[event.controller].ports.size()) {
+                j_event["name"] = controllers[event.controller].ports[event.port].name;
+            }
+        }
+        j_events.push_back(std::move(j_event));
+    }
+    nlohmann::json data = {
+            {"last_seq", last_seq},
+            {"dropped", dropped},
+            {"events", std::move(j_events)}
+    };
+    return makeResponse(std::move(data), "");
 }
 
 string getJsonFromControllersSer(vector<PoeController>& controllers) {
     return getJsonFromControllers(controllers).dump(4);  // "4" sets tabs for formatting output
 }
 
+/* Deadline of the commands of the batch the thread is serving, 0 out of a batch */
+static thread_local uint64_t batch_deadline_us = 0;
+
+/* Queue the command for the control loop and answer once it is applied, with the time it took.
+ * The commands of a batch share one timeout, so a batch can't hold its connection for a timeout per command
+ */
+static nlohmann::json submitCommand(PoeCommandKind kind, size_t contr_ind, size_t port_ind, double value) {
+    uint64_t timeout_us = poe_commands.getTimeout();
+    if (batch_deadline_us != 0) {
+        uint64_t now_us = monotonicUs();
+        if (now_us >= batch_deadline_us) {
+            return makeResponse("", "Batch time is over, the command is not applied");
+        }
+        timeout_us = batch_deadline_us - now_us;
+    }
+    /* The command keeps the indexes in 32 bits, check them before the cast */
+    if (contr_ind >= POE_CONTROLLERS_MAX || (port_ind != POE_COMMAND_NO_PORT && port_ind >= POE_CONTROLLER_PORTS_MAX)) {
+        return makeResponse("", "Index is out of range");
+    }
+    PoeCommand command{};
+    command.kind = kind;
+    command.controller = (uint32_t)contr_ind;
+    command.port = (uint32_t)port_ind;
+    command.value = value;
+    PoeCommandResult result;
+    if (!poe_commands.submit(command, result, timeout_us)) {
+        return makeResponse("", result.error);
+    }
+    return makeResponse(nlohmann::json{{"latency_us", result.latency_us}}, "");
+}
+
+static nlohmann::json handleSetPortPower(const nlohmann::json& msg, vector<PoeController>& controllers,
+                                         const PortNameIndex& port_index) {
+    string error_msg;
+    size_t contr_ind;
+    size_t port_ind;
+    if (!getRequestPort(msg, controllers, port_index, contr_ind, port_ind, error_msg)) {
+        return makeResponse("", error_msg);
+    }
+    auto enable = msg.find("enable");
+    if (enable == msg.end() || !enable->is_boolean()) {
+        return makeResponse("", "Field 'enable' must be a boolean");
+    }
+    return submitCommand(PoeCommandKind::SET_PORT_POWER, contr_ind, port_ind, enable->get<bool>() ? 1.0 : 0.0);
+}
+
+static nlohmann::json handleSetMode(const nlohmann::json& msg, vector<PoeController>& controllers,
+                                    const PortNameIndex& port_index) {
+    string error_msg;
+    size_t contr_ind;
+    size_t port_ind;
+    if (!getRequestPort(msg, controllers, port_index, contr_ind, port_ind, error_msg)) {
+        return makeResponse("", error_msg);
+    }
+    auto mode = msg.find("mode");
+    if (mode != msg.end() && mode->is_string()) {
+        for (size_t i = 0; i < (size_t)PoeMode::COUNT; i++) {
+            if (isPoeModeSupported((PoeMode)i) && poeModeToString((PoeMode)i) == mode->get_ref<const string&>()) {
+                return submitCommand(PoeCommandKind::SET_MODE, contr_ind, port_ind, i);
+            }
+        }
+    }
+    return makeResponse("", "Field 'mode' must be one of OFF, AUTO or 48V");
+}
+
+/* Budget of the port addressed by "name" or "index", or the total budget of the "controller" without them */
+static nlohmann::json handleSetBudget(const nlohmann::json& msg, vector<PoeController>& controllers,
+                                      const PortNameIndex& port_index) {
+    string error_msg;
+    size_t contr_ind;
+    size_t port_ind = POE_COMMAND_NO_PORT;
+    bool port_budget = msg.find("name") != msg.end() || msg.find("index") != msg.end();
+    if (port_budget ? !getRequestPort(msg, controllers, port_index, contr_ind, port_ind, error_msg) :
+                      !getRequestController(msg, controllers, contr_ind, error_msg)) {
+        return makeResponse("", error_msg);
+    }
+    auto budget = msg.find("budget");
+    if (budget == msg.end() || !budget->is_number() || !(budget->get<double>() > 0.0) ||
+        !std::isfinite(budget->get<double>())) {
+        return makeResponse("", "Field 'budget' must be a positive number of watts");
+    }
+    return submitCommand(PoeCommandKind::SET_BUDGET, contr_ind, port_ind, budget->get<double>());
+}
+
+static nlohmann::json handleSetPriority(const nlohmann::json& msg, vector<PoeController>& controllers,
+                                        const PortNameIndex& port_index) {
+    string error_msg;
+    size_t contr_ind;
+    size_t port_ind;
+    if (!getRequestPort(msg, controllers, port_index, contr_ind, port_ind, error_msg)) {
+        return makeResponse("", error_msg);
+    }
+    auto priority = msg.find("priority");
+    if (priority == msg.end() || !priority->is_number_integer() || priority->get<int64_t>() < 1 ||
+        priority->get<int64_t>() > INT32_MAX) {
+        return makeResponse("", "Field 'priority' must be a positive integer");
+    }
+    return submitCommand(PoeCommandKind::SET_PRIORITY, contr_ind, port_ind, priority->get<int64_t>());
+}
+
+static nlohmann::json handleGetMetrics(const nlohmann::json&, vector<PoeController>&, const PortNameIndex&) {
+    return makeResponse(poe_metrics.get(), "");
+}
+
+static nlohmann::json handleGetStats(const nlohmann::json&, vector<PoeController>& controllers,
+                                     const PortNameIndex&) {
+    lock_guard<mutex> guard(controllers_lock);
+    return makeResponse(getJsonStats(controllers), "");
+}
+
+static nlohmann::json handleBatch(const nlohmann::json& msg, vector<PoeController>& controllers,
+                                  const PortNameIndex& port_index);
+
+typedef nlohmann::json (*SocketHandler)(const nlohmann::json& msg, vector<PoeController>& controllers,
+                                        const PortNameIndex& port_index);
+
+struct SocketCommand {
+    const char* name;
+    SocketHandler handler;
+};
+
+static const SocketCommand socket_commands[] = {
+        {"get_all",        handleGetAll},
+        {"get_port",       handleGetPort},
+        {"get_controller", handleGetController},
+        {"get_metrics",    handleGetMetrics},
+        {"get_stats",      handleGetStats},
+        {"get_energy",     handleGetEnergy},
+        {"get_events",     handleGetEvents},
+        {"set_port_power", handleSetPortPower},
+        {"set_mode",       handleSetMode},
+        {"set_budget",     handleSetBudget},
+        {"set_priority",   handleSetPriority},
+        {"batch",          handleBatch}
+};
+
+/* Answer one request, the errors are reported in the response and the "id" of the request is echoed.
+ * The requests of a batch may omit "msg_type" and can't be batches themselves
+ */
+static nlohmann::json dispatchRequest(const nlohmann::json& msg, vector<PoeController>& controllers,
+                                      const PortNameIndex& port_index, bool batched) {
+    if (!msg.is_object()) {
+        POE_LOG(SOCKET, LOG_ERR, "Bad request, msg isn't a JSON object\n");
+        return makeResponse("", "Request must be a JSON object");
+    }
+
+    nlohmann::json j_response;
+    auto msg_type = msg.find("msg_type");
+    auto data = msg.find("data");
+    if (msg_type == msg.end() && !batched) {
+        POE_LOG(SOCKET, LOG_ERR, "Bad request, msg doesn't have 'msg_type' field\n");
+        j_response = makeResponse("", "Field 'msg_type' wasn't found");
+    } else if (msg_type != msg.end() && *msg_type != "request") {
+        POE_LOG(SOCKET, LOG_ERR, "Bad request, received message with 'msg_type': %s\n", msg_type->dump().c_str());
+        j_response = makeResponse("", "Wrong 'msg_type'");
+    } else if (data == msg.end() || !data->is_string()) {
+        POE_LOG(SOCKET, LOG_ERR, "Bad request, msg doesn't have 'data' field\n");
+        j_response = makeResponse("", "Field 'data' wasn't found");
+    } else {
+        const string& command = data->get_ref<const string&>();
+        SocketHandler handler = nullptr;
+        for (const auto& socket_command: socket_commands) {
+            if (command == socket_command.name) {
+                handler = socket_command.handler;
+                break;
+            }
+        }
+        if (handler == nullptr) {
+            j_response = makeResponse("", "Unrecognized command");
+        } else if (batched && handler == handleBatch) {
+            j_response = makeResponse("", "Batch can't be nested");
+        } else {
+            j_response = handler(msg, controllers, port_index);
+        }
+    }
+
+    auto id = msg.find("id");
+    if (id != msg.end()) {
+        j_response["id"] = *id;
+    }
+    return j_response;
+}
+
+/* Requests of the "requests" array answered in one response, the "data" is the array of their responses */
+static nlohmann::json handleBatch(const nlohmann::json& msg, vector<PoeController>& controllers,
+                                  const PortNameIndex& port_index) {
+    auto requests = msg.find("requests");
+    if (requests == msg.end() || !requests->is_array()) {
+        return makeResponse("", "Field 'requests' must be an array");
+    }
+    if (requests->size() > POE_SOCKET_BATCH_MAX) {
+        return makeResponse("", "Batch has more than " + to_string(POE_SOCKET_BATCH_MAX) + " requests");
+    }
+    nlohmann::json j_responses = nlohmann::json::array();
+    batch_deadline_us = monotonicUs() + poe_commands.getTimeout();
+    for (const auto& request: *requests) {
+        j_responses.push_back(dispatchRequest(request, controllers, port_index, true));
+    }
+    batch_deadline_us = 0;
+    return makeResponse(std::move(j_responses), "");
+}
+
+/* One response per line, the clients pretty-print it if they need to */
+static bool sendResponse(int sock, const nlohmann::json& j_response) {
+    string message = j_response.dump();
+    message += '\n';
+    size_t sent = 0;
+    while (sent < message.size()) {
+        ssize_t num_bytes = send(sock, message.c_str() + sent, message.size() - sent, MSG_NOSIGNAL);
+        if (num_bytes < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        sent += num_bytes;
+    }
+    return true;
+}
+
+/* Serve the requests of a client until it closes the connection. The requests are a stream of JSON objects,
+ * so a client can pipeline several of them in one write or split one over several, each one is answered in turn
+ */
+static void serveSocketClient(int client_sock, vector<PoeController>& controllers, const PortNameIndex& port_index) {
+    string pending;
+    char buffer[4096];
+    for (;;) {
+        ssize_t num_bytes = recv(client_sock, buffer, sizeof(buffer), 0);
+        if (num_bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if (num_bytes <= 0) {
+            if (num_bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                POE_LOG(SOCKET, LOG_DEBUG, "Closing connection idle for %d ms\n", POE_SOCKET_IDLE_TIMEOUT_MS);
+            } else if (num_bytes < 0) {
+                POE_LOG(SOCKET, LOG_ERR, "Failed to receive data\n");
+            } else if (pending.find_first_not_of(" \t\r\n") != string::npos) {
+                POE_LOG(SOCKET, LOG_ERR, "Bad request, connection closed in the middle of the request\n");
+                sendResponse(client_sock, makeResponse("", "Incomplete request"));
+            }
+            return;
+        }
+        pending.append(buffer, num_bytes);
+
+        size_t start = 0;
+        size_t end;
+        while ((end = findJsonValueEnd(pending, start)) != string::npos) {
+            POE_LOG(SOCKET, LOG_DEBUG, "Received %s\n", pending.substr(start, end - start).c_str());
+            nlohmann::json msg = nlohmann::json::parse(pending.begin() + start, pending.begin() + end, nullptr, false);
+            start = end;
+            nlohmann::json j_response;
+            if (msg.is_discarded()) {
+                POE_LOG(SOCKET, LOG_ERR, "Bad request, JSON parsing error\n");
+                j_response = makeResponse("", "JSON parsing error");
+            } else {
+                j_response = dispatchRequest(msg, controllers, port_index, false);
+            }
+            if (!sendResponse(client_sock, j_response)) {
+                POE_LOG(SOCKET, LOG_ERR, "Failed to send response\n");
+                return;
+            }
+        }
+        pending.erase(0, start);
+
+        if (pending.size() > POE_SOCKET_REQUEST_MAX) {
+            POE_LOG(SOCKET, LOG_ERR, "Bad request, request is longer than %d bytes\n", POE_SOCKET_REQUEST_MAX);
+            sendResponse(client_sock, makeResponse("", "Request is too long"));
+            return;
+        }
+    }
+}
+
 void handleUnixSocketServer(const std::string& socket_path, vector<PoeController>& controllers) {
     int server_sock, client_sock;
     struct sockaddr_un server_addr;
 
     /* Create a UNIX socket */
     if ((server_sock = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
-        syslog(LOG_ERR, "Failed to create socket\n");
+        POE_LOG(SOCKET, LOG_ERR, "Failed to create socket\n");
         return;
     }
 
@@ -188,178 +985,325 @@ void handleUnixSocketServer(const std::string& socket_path, vector<PoeController
 
     /* Bind the socket to the specified path */
     if (bind(server_sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) == -1) {
-        syslog(LOG_ERR, "Failed to bind socket\n");
+        POE_LOG(SOCKET, LOG_ERR, "Failed to bind socket\n");
         close(server_sock);
         exit(-1);
     }
 
-    /* Start listening for incoming connections (max queue: 1) */
-    if (listen(server_sock, 1) == -1) {
-        syslog(LOG_ERR, "Failed to listen on socket\n");
+    /* Start listening for incoming connections */
+    if (listen(server_sock, POE_SOCKET_CLIENTS_MAX) == -1) {
+        POE_LOG(SOCKET, LOG_ERR, "Failed to listen on socket\n");
         close(server_sock);
         return;
     }
 
-    syslog(LOG_INFO, "Listening on UNIX socket: %s\n", socket_path.c_str());
+    POE_LOG(SOCKET, LOG_INFO, "Listening on UNIX socket: %s\n", socket_path.c_str());
+
+    /* Port set doesn't change after startup, so the index is built once */
+    PortNameIndex port_index = buildPortNameIndex(controllers);
+
+    /* Every connection is served by its own thread, so a slow or idle client doesn't hold up the others */
+    mutex clients_lock;
+    condition_variable clients_cv;
+    int clients = 0;
+    struct timeval idle_timeout = {POE_SOCKET_IDLE_TIMEOUT_MS / 1000, (POE_SOCKET_IDLE_TIMEOUT_MS % 1000) * 1000};
 
     for (;;) {
+        {
+            unique_lock<mutex> guard(clients_lock);
+            clients_cv.wait(guard, [&]() { return clients < POE_SOCKET_CLIENTS_MAX; });
+        }
+
         /* Accept an incoming connection */
-        syslog(LOG_INFO, "Waiting for new connection\n");
-        if ((client_sock = accept(server_sock, NULL, NULL)) == -1) {
-            syslog(LOG_ERR, "Failed to accept connection\n");
+        POE_LOG(SOCKET, LOG_INFO, "Waiting for new connection\n");
+        if ((client_sock = accept4(server_sock, NULL, NULL, SOCK_CLOEXEC)) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            POE_LOG(SOCKET, LOG_ERR, "Failed to accept connection\n");
             close(server_sock);
+            /* The clients use the port index of the stack */
+            unique_lock<mutex> guard(clients_lock);
+            clients_cv.wait(guard, [&]() { return clients == 0; });
             return;
         }
 
-        /* Handle messages from the client */
-        char buffer[1024];
-        for (;;) {
-            ssize_t num_bytes = recv(client_sock, buffer, sizeof(buffer) - 1, 0);
-            if (num_bytes > 0) {
-                buffer[num_bytes] = '\0'; /* Add null terminator to the received string */
-
-                string received_message(buffer);
-                syslog(LOG_DEBUG, "Received %s\n", received_message.c_str());
-
-                /* Parse received json */
-                nlohmann::json msg;
-                nlohmann::json j_response;
-                try {
-                    msg = nlohmann::json::parse(received_message);
-                }
-                catch (const nlohmann::json::exception& e) {
-                    syslog(LOG_ERR, "Bad request, JSON parsing error: %s\n", e.what());
-                    j_response = {
-                            {"msg_type", "response"},
-                            {"data", ""},
-                            {"error_msg", "JSON parsing error"}
-                    };
-                    string response_message = j_response.dump(4);
-                    send(client_sock, response_message.c_str(), response_message.size(), 0);
-                    continue;
-                }
-
-                string msg_type;
-                try {
-                    msg_type = msg["msg_type"];
-                }
-                catch (const nlohmann::json::exception& e) {
-                    syslog(LOG_ERR, "Bad request, msg doesn't have 'msg_type' field\n");
-                    j_response = {
-                            {"msg_type", "response"},
-                            {"data", ""},
-                            {"error_msg", "Field 'msg_type' wasn't found"}
-                    };
-                    string response_message = j_response.dump(4);
-                    send(client_sock, response_message.c_str(), response_message.size(), 0);
-                    continue;
-                }
-
-                if (msg_type != "request") {
-                    syslog(LOG_ERR, "Bad request, received message with 'msg_type': %s\n",
-                           msg_type.c_str());
-                    j_response = {
-                            {"msg_type", "response"},
-                            {"data", ""},
-                            {"error_msg", "Wrong 'msg_type'"}
-                    };
-                    string response_message = j_response.dump(4);
-                    send(client_sock, response_message.c_str(), response_message.size(), 0);
-                    continue;
-                }
-
-                string data;
-                try {
-                    data = msg["data"];
-                }
-                catch (const nlohmann::json::exception& e) {
-                    syslog(LOG_ERR, "Bad request, msg doesn't have 'data' field\n");
-                    j_response = {
-                            {"msg_type", "response"},
-                            {"data", ""},
-                            {"error_msg", "Field 'data' wasn't found"}
-                    };
-                    string response_message = j_response.dump(4);
-                    send(client_sock, response_message.c_str(), response_message.size(), 0);
-                    continue;
-                }
+        /* Neither a client that keeps the connection open without requests nor one that doesn't read
+         * its responses keeps the thread forever
+         */
+        setsockopt(client_sock, SOL_SOCKET, SO_RCVTIMEO, &idle_timeout, sizeof(idle_timeout));
+        setsockopt(client_sock, SOL_SOCKET, SO_SNDTIMEO, &idle_timeout, sizeof(idle_timeout));
 
-                /* Check the received command */
-                if (data == "get_all") {
-                    /* Send the response message */
-                    nlohmann::json poe_data = getJsonFromControllers(controllers);
-                    j_response = {
-                            {"msg_type", "response"},
-                            {"data", poe_data},
-                            {"error_msg", ""}
-                    };
-                } else {
-                    j_response = {
-                            {"msg_type", "response"},
-                            {"data", ""},
-                            {"error_msg", "Unrecognized command"}
-                    };
-                }
-                string response_message = j_response.dump(4);
-                send(client_sock, response_message.c_str(), response_message.size(), 0);
-            } else {
-                syslog(LOG_ERR, "Failed to receive data\n");
-                break;
-            }
+        {
+            lock_guard<mutex> guard(clients_lock);
+            clients++;
         }
+        thread([&, client_sock]() {
+            serveSocketClient(client_sock, controllers, port_index);
+            close(client_sock);
+            lock_guard<mutex> guard(clients_lock);
+            clients--;
+            clients_cv.notify_all();
+        }).detach();
     }
 }
 
-string requestFromUnixSocket(const string& socket_path, const string& message, int timeout_ms) {
+/* Send the message and write the whole response to the stream until the server closes the connection */
+bool streamFromUnixSocket(const string& socket_path, const string& message, int timeout_ms,
+                          ostream& out, string& error_msg) {
     int sock;
     struct sockaddr_un server_addr{};
 
     /* Create a socket */
-    if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
-        return "Failed to create socket";
+    if ((sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1) {
+        error_msg = "Failed to create socket";
+        return false;
     }
 
     /* Set up the server address */
-    memset(&server_addr, 0, sizeof(server_addr));
     server_addr.sun_family = AF_UNIX;
     strncpy(server_addr.sun_path, socket_path.c_str(), sizeof(server_addr.sun_path) - 1);
 
     /* Connect to the server */
     if (connect(sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) == -1) {
         close(sock);
-        return "Failed to connect to socket";
+        error_msg = "Failed to connect to socket " + socket_path;
+        return false;
     }
 
-    /* Send the message to the server */
-    if (send(sock, message.c_str(), message.size(), 0) == -1) {
+    /* Send the message and tell the server there are no more requests */
+    if (send(sock, message.c_str(), message.size(), MSG_NOSIGNAL) == -1) {
         close(sock);
-        return "Failed to send message";
+        error_msg = "Failed to send message";
+        return false;
     }
+    shutdown(sock, SHUT_WR);
 
-    /* Wait for the response with a timeout */
     struct pollfd pfd{};
     pfd.fd = sock;
-    pfd.events = POLLIN;  // We are interested in reading
+    pfd.events = POLLIN;
+
+    char buffer[8192];
+    for (;;) {
+        int poll_result = poll(&pfd, 1, timeout_ms);
+        if (poll_result == 0) {
+            close(sock);
+            error_msg = "Timeout waiting for response";
+            return false;
+        } else if (poll_result == -1) {
+            close(sock);
+            error_msg = "Error while waiting for response";
+            return false;
+        }
 
-    int poll_result = poll(&pfd, 1, timeout_ms);
+        ssize_t num_bytes = recv(sock, buffer, sizeof(buffer), 0);
+        if (num_bytes == 0) {
+            break;
+        } else if (num_bytes < 0) {
+            close(sock);
+            error_msg = "Failed to receive response";
+            return false;
+        }
+        out.write(buffer, num_bytes);
+    }
 
-    if (poll_result == 0) {
-        close(sock);
-        return "Timeout waiting for response";
-    } else if (poll_result == -1) {
-        close(sock);
-        return "Error while waiting for response";
+    close(sock);
+    return true;
+}
+
+string requestFromUnixSocket(const string& socket_path, const string& message, int timeout_ms) {
+    ostringstream response;
+    string error_msg;
+    if (!streamFromUnixSocket(socket_path, message, timeout_ms, response, error_msg)) {
+        return error_msg;
     }
+    return response.str();
+}
 
-    /* Receive the response from the server */
-    char buffer[8192];
-    ssize_t num_bytes = recv(sock, buffer, sizeof(buffer) - 1, 0);
-    if (num_bytes > 0) {
-        buffer[num_bytes] = '\0';  // Null-terminate the received string
+static int connectUnixSocket(const string& socket_path) {
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock == -1) {
+        return -1;
+    }
+
+    struct sockaddr_un server_addr{};
+    server_addr.sun_family = AF_UNIX;
+    strncpy(server_addr.sun_path, socket_path.c_str(), sizeof(server_addr.sun_path) - 1);
+    if (connect(sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) == -1) {
         close(sock);
-        return buffer;  // Return the received response
-    } else {
+        return -1;
+    }
+    return sock;
+}
+
+/* Receive one complete JSON response, the rest of the data is left in the buffer */
+static SocketLoadStatus receiveJsonResponse(int sock, string& buffer, int timeout_ms, string& response) {
+    struct pollfd pfd{};
+    pfd.fd = sock;
+    pfd.events = POLLIN;
+
+    char chunk[8192];
+    for (;;) {
+        size_t end = findJsonValueEnd(buffer, 0);
+        if (end != string::npos) {
+            response = buffer.substr(0, end);
+            buffer.erase(0, end);
+            return SocketLoadStatus::OK;
+        }
+
+        int poll_result = poll(&pfd, 1, timeout_ms);
+        if (poll_result == 0) {
+            return SocketLoadStatus::TIMEOUT;
+        } else if (poll_result == -1) {
+            return SocketLoadStatus::IO_ERROR;
+        }
+
+        ssize_t num_bytes = recv(sock, chunk, sizeof(chunk), 0);
+        if (num_bytes == 0) {
+            /* Connection closed in the middle of the response */
+            return buffer.find_first_not_of(" \t\r\n") == string::npos ?
+                   SocketLoadStatus::IO_ERROR : SocketLoadStatus::TRUNCATED;
+        } else if (num_bytes < 0) {
+            return SocketLoadStatus::IO_ERROR;
+        }
+        buffer.append(chunk, num_bytes);
+    }
+}
+
+static SocketLoadStatus validateJsonResponse(const string& response) {
+    nlohmann::json j_response = nlohmann::json::parse(response, nullptr, false);
+    if (j_response.is_discarded() || !j_response.is_object()) {
+        return SocketLoadStatus::INVALID_JSON;
+    }
+    auto msg_type = j_response.find("msg_type");
+    auto error_msg = j_response.find("error_msg");
+    if (msg_type == j_response.end() || *msg_type != "response") {
+        return SocketLoadStatus::INVALID_JSON;
+    }
+    if (error_msg != j_response.end() && error_msg->is_string() && !error_msg->get<string>().empty()) {
+        return SocketLoadStatus::ERROR_RESPONSE;
+    }
+    return SocketLoadStatus::OK;
+}
+
+/* One client of the load generator, sends requests in closed loop or at the fixed rate */
+static void runSocketLoadClient(const SocketLoadOptions& options, size_t client_ind, uint64_t deadline_us,
+                                SocketLoadResult& result) {
+    string buffer;
+    string response;
+    int sock = -1;
+    uint64_t interval_us = options.rate > 0.0 ? (uint64_t)(1e6 / options.rate) : 0;
+    uint64_t next_send_us = monotonicUs();
+    size_t msg_ind = client_ind;
+
+    while (monotonicUs() < deadline_us) {
+        if (interval_us > 0) {
+            uint64_t now_us = monotonicUs();
+            if (now_us < next_send_us) {
+                usleep(next_send_us - now_us);
+            }
+        }
+
+        /* With the fixed rate latency counts from the scheduled send time, so stalls are not hidden */
+        uint64_t start_us = interval_us > 0 ? next_send_us : monotonicUs();
+        next_send_us += interval_us;
+        const string& message = options.messages[msg_ind++ % options.messages.size()];
+
+        if (sock < 0) {
+            sock = connectUnixSocket(options.socket_path);
+            if (sock < 0) {
+                result.status_cnt[(int)SocketLoadStatus::CONNECT_ERROR]++;
+                usleep(10000);
+                continue;
+            }
+            buffer.clear();
+        }
+
+        SocketLoadStatus status = SocketLoadStatus::OK;
+        if (send(sock, message.c_str(), message.size(), MSG_NOSIGNAL) != (ssize_t)message.size()) {
+            status = SocketLoadStatus::IO_ERROR;
+        } else {
+            if (!options.persistent) {
+                shutdown(sock, SHUT_WR);
+            }
+            status = receiveJsonResponse(sock, buffer, options.timeout_ms, response);
+            if (status == SocketLoadStatus::OK) {
+                status = validateJsonResponse(response);
+            }
+        }
+        uint64_t end_us = monotonicUs();
+
+        result.status_cnt[(int)status]++;
+        if (status == SocketLoadStatus::OK || status == SocketLoadStatus::ERROR_RESPONSE) {
+            result.latencies_us.push_back(end_us - start_us);
+            result.bytes += response.size();
+        }
+        if (!options.persistent || status != SocketLoadStatus::OK) {
+            close(sock);
+            sock = -1;
+        }
+    }
+
+    if (sock >= 0) {
         close(sock);
-        return "Failed to receive response";
     }
-}
\ No newline at end of file
+}
+
+SocketLoadResult runSocketLoad(const SocketLoadOptions& options) {
+    vector<SocketLoadResult> results(options.connections);
+    vector<thread> clients;
+
+    uint64_t start_us = monotonicUs();
+    uint64_t deadline_us = start_us + (uint64_t)(options.duration_s * 1e6);
+    for (size_t i = 0; i < results.size(); i++) {
+        clients.emplace_back(runSocketLoadClient, std::cref(options), i, deadline_us, std::ref(results[i]));
+    }
+    for (auto& client: clients) {
+        client.join();
+    }
+
+    SocketLoadResult total;
+    total.elapsed_s = (monotonicUs() - start_us) / 1e6;
+    for (const auto& result: results) {
+        for (int i = 0; i < (int)SocketLoadStatus::COUNT; i++) {
+            total.status_cnt[i] += result.status_cnt[i];
+        }
+        total.bytes += result.bytes;
+        total.latencies_us.insert(total.latencies_us.end(), result.latencies_us.begin(), result.latencies_us.end());
+    }
+    sort(total.latencies_us.begin(), total.latencies_us.end());
+    return total;
+}
+
+nlohmann::json getJsonFromSocketLoadResult(const SocketLoadResult& result) {
+    static const char* status_names[(int)SocketLoadStatus::COUNT] = {
+            "ok", "error_response", "connect_error", "io_error", "timeout", "truncated", "invalid_json"
+    };
+
+    const vector<uint64_t>& lat = result.latencies_us;
+    auto percentile = [&lat](double p) -> uint64_t {
+        if (lat.empty()) {
+            return 0;
+        }
+        size_t ind = (size_t)(p / 100.0 * lat.size());
+        return lat[ind < lat.size() ? ind : lat.size() - 1];
+    };
+
+    nlohmann::json j_status = nlohmann::json::object();
+    for (int i = 0; i < (int)SocketLoadStatus::COUNT; i++) {
+        j_status[status_names[i]] = result.status_cnt[i];
+    }
+    uint64_t completed = result.status_cnt[(int)SocketLoadStatus::OK] + result.status_cnt[(int)SocketLoadStatus::ERROR_RESPONSE];
+
+    return nlohmann::json{
+            {"elapsed_s", result.elapsed_s},
+            {"requests", completed},
+            {"throughput_rps", result.elapsed_s > 0.0 ? completed / result.elapsed_s : 0.0},
+            {"bytes", result.bytes},
+            {"p50_us", percentile(50.0)},
+            {"p99_us", percentile(99.0)},
+            {"p999_us", percentile(99.9)},
+            {"max_us", lat.empty() ? 0 : lat.back()},
+            {"status", j_status}
+    };
+}
@@ -0,0 +1,211 @@
+/*
+ * © 2024 Proxeet Limited
+ *
+ * The poed packet is licensed under the GNU Lesser General Public License version 3,
+ * published by the Free Software Foundation.
+ *
+ * You may use, distribute, and modify this code under the terms of the LGPLv3.
+ *
+ * The project is distributed WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU Lesser General Public License version 3 for more details.
+ *
+ * Author: Aleksey Vasilenko (a.vasilenko@proxeet.com)
+ */
+
+#include "metrics.h"
+#include "logs.h"
+#include "poe_schema.h"
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+MetricsBuffer poe_metrics;
+
+static const time_t start_time = time(nullptr);
+
+void MetricsBuffer::append(const char* fmt, ...) {
+    char buf[256];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    if (len > 0) {
+        rendering.append(buf, len < (int)sizeof(buf) ? len : sizeof(buf) - 1);
+    }
+}
+
+void MetricsBuffer::appendFamily(const char* name, const char* type, const char* unit, const char* help) {
+    append("# TYPE %s %s\n", name, type);
+    if (unit[0] != '\0') {
+        append("# UNIT %s %s\n", name, unit);
+    }
+    append("# HELP %s %s\n", name, help);
+}
+
+void MetricsBuffer::appendPortLabels(size_t contr_ind, const PoePort& port) {
+    append("{controller=\"%zu\",port=\"%d\",name=\"", contr_ind, port.index);
+    /* Escape label value as the format requires */
+    for (char ch: port.name) {
+        if (ch == '"' || ch == '\\') {
+            rendering.push_back('\\');
+        } else if (ch == '\n') {
+            rendering.append("\\n");
+            continue;
+        }
+        rendering.push_back(ch);
+    }
+    rendering.append("\"}");
+}
+
+void MetricsBuffer::render(const vector<PoeController>& controllers, const DaemonStats& stats) {
+    rendering.clear();
+
+    /* Per-port families of the schema, every family is written as one block as the format requires */
+    for (size_t f = 0; f < (size_t)PoePortField::COUNT; f++) {
+        const PoePortFieldInfo& field = poe_port_fields[f];
+        if (field.metric == nullptr) {
+            continue;
+        }
+        bool counter = field.kind == PoeFieldKind::COUNTER || field.kind == PoeFieldKind::ENERGY;
+        const char* format = " %g\n";
+        if (field.kind == PoeFieldKind::COUNTER) {
+            format = " %.0f\n";
+        } else if (field.kind == PoeFieldKind::ENERGY) {
+            format = " %.6f\n";
+        }
+        appendFamily(field.metric, counter ? "counter" : "gauge", field.unit, field.help);
+        for (size_t c = 0; c < controllers.size(); c++) {
+            for (size_t i = 0; i < controllers[c].ports.size(); i++) {
+                rendering.append(field.metric);
+                if (counter) {
+                    rendering.append("_total");
+                }
+                appendPortLabels(c, controllers[c].ports[i]);
+                append(format, getPortFieldValue((PoePortField)f, controllers[c], i));
+            }
+        }
+    }
+
+    /* Controller totals */
+    appendFamily("poed_controller_power_watts", "gauge", "watts", "Total output power of the controller ports.");
+    for (size_t c = 0; c < controllers.size(); c++) {
+        append("poed_controller_power_watts{controller=\"%zu\"} %g\n", c, controllers[c].getTotalPower());
+    }
+    appendFamily("poed_controller_energy_joules", "counter", "joules", "Energy delivered by the controller ports.");
+    for (size_t c = 0; c < controllers.size(); c++) {
+        append("poed_controller_energy_joules_total{controller=\"%zu\"} %.6f\n", c,
+               controllers[c].energy_uj.get() / 1e6);
+    }
+    appendFamily("poed_controller_budget_watts", "gauge", "watts", "Total power budget of the controller.");
+    for (size_t c = 0; c < controllers.size(); c++) {
+        append("poed_controller_budget_watts{controller=\"%zu\"} %g\n", c, controllers[c].total_budget);
+    }
+
+    appendFamily("poed_controller_health", "gauge", "", "Controller health, 0 is ok, 1 is degraded, 2 is failed.");
+    for (size_t c = 0; c < controllers.size(); c++) {
+        append("poed_controller_health{controller=\"%zu\"} %d\n", c, (int)controllers[c].health);
+    }
+    appendFamily("poed_controller_failed_reads", "counter", "", "Failed reads of the controller ports data.");
+    for (size_t c = 0; c < controllers.size(); c++) {
+        append("poed_controller_failed_reads_total{controller=\"%zu\"} %llu\n", c,
+               (unsigned long long)controllers[c].stats.failed_reads.get());
+    }
+    appendFamily("poed_controller_phase_p99_seconds", "gauge", "seconds",
+                 "99th percentile of the control cycle phase duration.");
+    for (size_t c = 0; c < controllers.size(); c++) {
+        for (int phase = 0; phase < PHASE_COUNT; phase++) {
+            append("poed_controller_phase_p99_seconds{controller=\"%zu\",phase=\"%s\"} %g\n", c,
+                   cyclePhaseToString((CyclePhase)phase), controllers[c].stats.phases[phase].getPercentile(99.0) / 1e6);
+        }
+    }
+
+    /* Daemon internals */
+    appendFamily("poed_cycles", "counter", "", "Control loop cycles.");
+    append("poed_cycles_total %llu\n", (unsigned long long)stats.cycles.get());
+    appendFamily("poed_cycle_overruns", "counter", "", "Control loop cycles longer than the monitoring period.");
+    append("poed_cycle_overruns_total %llu\n", (unsigned long long)stats.overruns.get());
+    appendFamily("poed_cycle_duration_seconds", "gauge", "seconds", "Duration of the last control loop cycle.");
+    append("poed_cycle_duration_seconds %g\n", stats.last_cycle_us.get() / 1e6);
+    appendFamily("poed_start_time_seconds", "gauge", "seconds", "Daemon start time since the epoch.");
+    append("poed_start_time_seconds %lld\n", (long long)start_time);
+    rendering.append("# EOF\n");
+
+    lock_guard<mutex> guard(lock);
+    published.swap(rendering);
+}
+
+string MetricsBuffer::get() {
+    lock_guard<mutex> guard(lock);
+    return published;
+}
+
+/* Minimal HTTP server for the scrapers, listens on loopback only */
+void handleMetricsHttpServer(int port) {
+    int server_sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (server_sock == -1) {
+        syslog(LOG_ERR, "Failed to create metrics socket\n");
+        return;
+    }
+
+    int reuse = 1;
+    setsockopt(server_sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in server_addr{};
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    server_addr.sin_port = htons(port);
+    if (bind(server_sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) == -1 ||
+        listen(server_sock, 4) == -1) {
+        syslog(LOG_ERR, "Failed to listen on metrics port %d\n", port);
+        close(server_sock);
+        return;
+    }
+
+    syslog(LOG_INFO, "Serving metrics on http://127.0.0.1:%d/metrics\n", port);
+
+    for (;;) {
+        int client_sock = accept(server_sock, nullptr, nullptr);
+        if (client_sock == -1) {
+            syslog(LOG_ERR, "Failed to accept metrics connection\n");
+            continue;
+        }
+
+        /* Read the request head, a slow client must not stall the listener */
+        char request[1024];
+        size_t received = 0;
+        struct pollfd pfd{};
+        pfd.fd = client_sock;
+        pfd.events = POLLIN;
+        while (received < sizeof(request) - 1 && poll(&pfd, 1, 1000) > 0) {
+            ssize_t num_bytes = recv(client_sock, request + received, sizeof(request) - 1 - received, 0);
+            if (num_bytes <= 0) {
+                break;
+            }
+            received += num_bytes;
+            request[received] = '\0';
+            if (strstr(request, "\r\n\r\n") != nullptr) {
+                break;
+            }
+        }
+        request[received] = '\0';
+
+        string response;
+        if (strncmp(request, "GET /metrics ", 13) == 0 || strncmp(request, "GET / ", 6) == 0) {
+            string body = poe_metrics.get();
+            response = "HTTP/1.1 200 OK\r\nContent-Type: " OPENMETRICS_CONTENT_TYPE "\r\nContent-Length: " +
+                       to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+        } else {
+            response = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        }
+        send(client_sock, response.c_str(), response.size(), MSG_NOSIGNAL);
+        close(client_sock);
+    }
+}
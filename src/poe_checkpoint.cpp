@@ -0,0 +1,327 @@
+/*
+ * © 2024 Proxeet Limited
+ *
+ * The poed packet is licensed under the GNU Lesser General Public License version 3,
+ * published by the Free Software Foundation.
+ *
+ * You may use, distribute, and modify this code under the terms of the LGPLv3.
+ *
+ * The project is distributed WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU Lesser General Public License version 3 for more details.
+ *
+ * Author: Aleksey Vasilenko (a.vasilenko@proxeet.com)
+ */
+
+#include "poe_checkpoint.h"
+#include "logs.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+PoeCheckpoint poe_checkpoint;
+
+/* CRC-32 of IEEE 802.3, crc is the running value, start with 0xFFFFFFFF and invert at the end */
+static uint32_t crc32Update(uint32_t crc, const uint8_t* data, size_t size) {
+    struct CrcTable {
+        uint32_t values[256];
+
+        CrcTable() {
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t crc = i;
+                for (int bit = 0; bit < 8; bit++) {
+                    crc = crc & 1 ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+                }
+                values[i] = crc;
+            }
+        }
+    };
+    static const CrcTable table;
+
+    for (size_t i = 0; i < size; i++) {
+        crc = table.values[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+static uint32_t crc32(const uint8_t* data, size_t size) {
+    return crc32Update(0xFFFFFFFFu, data, size) ^ 0xFFFFFFFFu;
+}
+
+static uint32_t nameHash(const string& name) {
+    return crc32((const uint8_t*)name.c_str(), name.size());
+}
+
+static size_t getSlotSize(size_t capacity) {
+    return sizeof(PoeCheckpointSlot) + capacity * sizeof(PoeCheckpointEntry);
+}
+
+static size_t getFileSize(size_t capacity) {
+    return sizeof(PoeCheckpointHeader) + 2 * getSlotSize(capacity);
+}
+
+static uint32_t getSlotCrc(const uint8_t* slot_ptr, size_t count) {
+    PoeCheckpointSlot slot;
+    memcpy(&slot, slot_ptr, sizeof(slot));
+    slot.crc = 0;
+    uint32_t crc = crc32Update(0xFFFFFFFFu, (const uint8_t*)&slot, sizeof(slot));
+    crc = crc32Update(crc, slot_ptr + sizeof(slot), count * sizeof(PoeCheckpointEntry));
+    return crc ^ 0xFFFFFFFFu;
+}
+
+/* Pointer to the current slot of the file content, nullptr if no slot is valid */
+static const uint8_t* findCurrentSlot(const uint8_t* data, size_t size, uint64_t& seq) {
+    PoeCheckpointHeader header;
+    if (size < sizeof(header)) {
+        return nullptr;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != POE_CHECKPOINT_MAGIC || header.version != POE_CHECKPOINT_VERSION ||
+            header.slot_size != getSlotSize(header.capacity) || size < getFileSize(header.capacity)) {
+        return nullptr;
+    }
+
+    const uint8_t* current = nullptr;
+    for (int i = 0; i < 2; i++) {
+        const uint8_t* slot_ptr = data + sizeof(header) + i * header.slot_size;
+        PoeCheckpointSlot slot;
+        memcpy(&slot, slot_ptr, sizeof(slot));
+        if (slot.seq == 0 || slot.count > header.capacity || slot.crc != getSlotCrc(slot_ptr, slot.count)) {
+            continue;
+        }
+        if (current == nullptr || slot.seq > seq) {
+            current = slot_ptr;
+            seq = slot.seq;
+        }
+    }
+    return current;
+}
+
+/* Apply the checkpointed flags to the ports before any of them is powered,
+ * entries of ports that are gone or renamed since the checkpoint are skipped
+ */
+bool PoeCheckpoint::load(const string& path, vector<PoeController>& controllers) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno != ENOENT) {
+            POE_LOG(STATE, LOG_ERR, "Can't open state checkpoint %s: %s\n", path.c_str(), strerror(errno));
+        }
+        return false;
+    }
+
+    vector<uint8_t> data;
+    uint8_t buffer[4096];
+    ssize_t num_bytes;
+    while ((num_bytes = read(fd, buffer, sizeof(buffer))) > 0) {
+        data.insert(data.end(), buffer, buffer + num_bytes);
+    }
+    ::close(fd);
+
+    uint64_t slot_seq = 0;
+    const uint8_t* slot_ptr = findCurrentSlot(data.data(), data.size(), slot_seq);
+    if (slot_ptr == nullptr) {
+        POE_LOG(STATE, LOG_WARNING, "State checkpoint %s has no valid state, start from scratch\n", path.c_str());
+        return false;
+    }
+
+    PoeCheckpointSlot slot;
+    memcpy(&slot, slot_ptr, sizeof(slot));
+    size_t restored = 0;
+    for (size_t i = 0; i < slot.count; i++) {
+        PoeCheckpointEntry entry;
+        memcpy(&entry, slot_ptr + sizeof(slot) + i * sizeof(entry), sizeof(entry));
+        if (entry.controller >= controllers.size()) {
+            continue;
+        }
+        PoeController& controller = controllers[entry.controller];
+        if (entry.port == POE_CHECKPOINT_CONTROLLER) {
+            if (nameHash(controller.path) == entry.name_hash) {
+                controller.energy_uj.set(entry.energy_uj);
+            }
+            continue;
+        }
+        if (entry.port >= controller.ports.size() || nameHash(controller.ports[entry.port].name) != entry.name_hash) {
+            continue;
+        }
+        controller.telemetry.setFlag(entry.port, POE_PORT_ENABLE_PERM, entry.flags & POE_PORT_ENABLE_PERM);
+        controller.telemetry.setFlag(entry.port, POE_PORT_OVERBUDGET, entry.flags & POE_PORT_OVERBUDGET);
+        controller.telemetry.energy_uj[entry.port].set(entry.energy_uj);
+        restored++;
+    }
+    POE_LOG(STATE, LOG_INFO, "Restored state of %zu ports from checkpoint %s, sequence %llu\n",
+            restored, path.c_str(), (unsigned long long)slot_seq);
+    return true;
+}
+
+/* Write the state to the slot after the current one, the sequence is a part of the CRC,
+ * so the slot becomes current only when it is written completely
+ */
+void PoeCheckpoint::writeSlot(const vector<PoeController>& controllers) {
+    PoeCheckpointHeader header;
+    memcpy(&header, map, sizeof(header));
+
+    seq++;
+    uint8_t* slot_ptr = map + sizeof(header) + (seq % 2) * header.slot_size;
+    uint32_t count = 0;
+    auto addEntry = [&](const PoeCheckpointEntry& entry) {
+        if (count < header.capacity) {
+            memcpy(slot_ptr + sizeof(PoeCheckpointSlot) + count * sizeof(entry), &entry, sizeof(entry));
+            count++;
+        }
+    };
+    for (size_t c = 0; c < controllers.size(); c++) {
+        const PoeController& controller = controllers[c];
+        PoeCheckpointEntry entry{};
+        entry.name_hash = nameHash(controller.path);
+        entry.controller = c;
+        entry.port = POE_CHECKPOINT_CONTROLLER;
+        entry.energy_uj = controller.energy_uj.get();
+        addEntry(entry);
+        for (size_t i = 0; i < controller.ports.size(); i++) {
+            entry.name_hash = nameHash(controller.ports[i].name);
+            entry.port = i;
+            entry.flags = controller.telemetry.flags[i] & POE_PORT_CHECKPOINTED;
+            entry.energy_uj = controller.telemetry.energy_uj[i].get();
+            addEntry(entry);
+        }
+    }
+
+    PoeCheckpointSlot slot{};
+    slot.seq = seq;
+    slot.count = count;
+    memcpy(slot_ptr, &slot, sizeof(slot));
+    slot.crc = getSlotCrc(slot_ptr, count);
+    memcpy(slot_ptr, &slot, sizeof(slot));
+}
+
+/* Build the new file aside and move it in place, the old checkpoint stays valid until the rename */
+bool PoeCheckpoint::create(const vector<PoeController>& controllers, size_t capacity) {
+    string tmp_path = path + ".tmp";
+    fd = ::open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        POE_LOG(STATE, LOG_ERR, "Can't create state checkpoint %s: %s\n", tmp_path.c_str(), strerror(errno));
+        return false;
+    }
+    map_size = getFileSize(capacity);
+    if (ftruncate(fd, map_size) < 0) {
+        POE_LOG(STATE, LOG_ERR, "Can't resize state checkpoint %s: %s\n", tmp_path.c_str(), strerror(errno));
+        close();
+        return false;
+    }
+    void* addr = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        POE_LOG(STATE, LOG_ERR, "Can't map state checkpoint %s: %s\n", tmp_path.c_str(), strerror(errno));
+        map = nullptr;
+        close();
+        return false;
+    }
+    map = (uint8_t*)addr;
+
+    PoeCheckpointHeader header{};
+    header.magic = POE_CHECKPOINT_MAGIC;
+    header.version = POE_CHECKPOINT_VERSION;
+    header.capacity = capacity;
+    header.slot_size = getSlotSize(capacity);
+    memcpy(map, &header, sizeof(header));
+    writeSlot(controllers);
+
+    if (rename(tmp_path.c_str(), path.c_str()) < 0) {
+        POE_LOG(STATE, LOG_ERR, "Can't move state checkpoint to %s: %s\n", path.c_str(), strerror(errno));
+        unlink(tmp_path.c_str());
+        close();
+        return false;
+    }
+    return true;
+}
+
+/* Map the checkpoint for writing and store the current state of the controllers into it,
+ * the existing file is reused if its layout fits the controllers
+ */
+bool PoeCheckpoint::open(const string& checkpoint_path, const vector<PoeController>& controllers) {
+    close();
+    path = checkpoint_path;
+    size_t capacity = 0;
+    for (const auto& controller: controllers) {
+        capacity += controller.ports.size() + 1;
+    }
+
+    fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+    struct stat st{};
+    if (fd >= 0 && fstat(fd, &st) == 0 && (size_t)st.st_size == getFileSize(capacity)) {
+        map_size = st.st_size;
+        void* addr = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        PoeCheckpointHeader header{};
+        if (addr != MAP_FAILED) {
+            map = (uint8_t*)addr;
+            memcpy(&header, map, sizeof(header));
+        }
+        if (map != nullptr && header.magic == POE_CHECKPOINT_MAGIC && header.version == POE_CHECKPOINT_VERSION &&
+                header.capacity == capacity) {
+            /* Continue the sequence, zero if no slot is valid */
+            seq = 0;
+            findCurrentSlot(map, map_size, seq);
+            save(controllers);
+            return true;
+        }
+    }
+    close();
+    path = checkpoint_path;
+    seq = 0;
+    if (!create(controllers, capacity)) {
+        return false;
+    }
+    POE_LOG(STATE, LOG_INFO, "Created state checkpoint %s for %zu entries\n", path.c_str(), capacity);
+    return true;
+}
+
+bool PoeCheckpoint::save(const vector<PoeController>& controllers) {
+    if (map == nullptr) {
+        return false;
+    }
+    writeSlot(controllers);
+    saved_gen = 0;
+    for (const auto& controller: controllers) {
+        saved_gen += controller.telemetry.checkpoint_gen;
+    }
+    return true;
+}
+
+/* Write when the control loop changed a checkpointed flag since the last save,
+ * the energy counters alone are written once per POE_CHECKPOINT_ENERGY_PERIOD_US
+ */
+bool PoeCheckpoint::saveIfChanged(const vector<PoeController>& controllers, uint64_t now_us) {
+    uint64_t gen = 0;
+    for (const auto& controller: controllers) {
+        gen += controller.telemetry.checkpoint_gen;
+    }
+    if (!dirty.exchange(false) && gen == saved_gen && now_us - saved_us < POE_CHECKPOINT_ENERGY_PERIOD_US) {
+        return false;
+    }
+    saved_us = now_us;
+    return save(controllers);
+}
+
+/* The state changed outside the control loop, i.e. the energy counters were reset by the socket */
+void PoeCheckpoint::markDirty() {
+    dirty = true;
+}
+
+void PoeCheckpoint::close() {
+    if (map != nullptr) {
+        munmap(map, map_size);
+        map = nullptr;
+    }
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+    map_size = 0;
+}
+
+PoeCheckpoint::~PoeCheckpoint() {
+    close();
+}
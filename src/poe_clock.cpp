@@ -0,0 +1,59 @@
+/*
+ * © 2024 Proxeet Limited
+ *
+ * The poed packet is licensed under the GNU Lesser General Public License version 3,
+ * published by the Free Software Foundation.
+ *
+ * You may use, distribute, and modify this code under the terms of the LGPLv3.
+ *
+ * The project is distributed WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU Lesser General Public License version 3 for more details.
+ *
+ * Author: Aleksey Vasilenko (a.vasilenko@proxeet.com)
+ */
+
+#include "poe_clock.h"
+#include "stats.h"
+#include <ctime>
+
+static RealClock real_clock;
+PoeClock* poe_clock = &real_clock;
+
+static uint64_t realtimeClockUs() {
+    struct timespec ts{};
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint64_t RealClock::nowUs() {
+    return monotonicUs();
+}
+
+uint64_t RealClock::realtimeUs() {
+    return realtimeClockUs();
+}
+
+void RealClock::sleepUs(uint64_t us) {
+    struct timespec ts{};
+    ts.tv_sec = us / 1000000;
+    ts.tv_nsec = (us % 1000000) * 1000;
+    nanosleep(&ts, nullptr);
+}
+
+/* Virtual time starts at the real time of the creation and moves only by sleeps */
+VirtualClock::VirtualClock() : start_us(monotonicUs()), start_realtime_us(realtimeClockUs()), elapsed_us(0) {
+}
+
+uint64_t VirtualClock::nowUs() {
+    return start_us + elapsed_us.load(std::memory_order_relaxed);
+}
+
+uint64_t VirtualClock::realtimeUs() {
+    return start_realtime_us + elapsed_us.load(std::memory_order_relaxed);
+}
+
+void VirtualClock::sleepUs(uint64_t us) {
+    elapsed_us.fetch_add(us, std::memory_order_relaxed);
+}
@@ -0,0 +1,165 @@
+/*
+ * © 2024 Proxeet Limited
+ *
+ * The poed packet is licensed under the GNU Lesser General Public License version 3,
+ * published by the Free Software Foundation.
+ *
+ * You may use, distribute, and modify this code under the terms of the LGPLv3.
+ *
+ * The project is distributed WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU Lesser General Public License version 3 for more details.
+ *
+ * Author: Aleksey Vasilenko (a.vasilenko@proxeet.com)
+ */
+
+
+#include "poe_commands.h"
+#include "logs.h"
+#include <chrono>
+
+PoeCommandQueue poe_commands;
+
+#define POE_COMMAND_KIND_NAME(value, name) name,
+
+static const char* const command_kind_names[] = {
+    POE_COMMAND_KINDS(POE_COMMAND_KIND_NAME)
+};
+
+const char* poeCommandKindToString(PoeCommandKind kind) {
+    size_t ind = static_cast<size_t>(kind);
+    return ind < static_cast<size_t>(PoeCommandKind::COUNT) ? command_kind_names[ind] : "unknown";
+}
+
+/* Queue the command and wait for its result until the timeout, called by the socket threads.
+ * The control loop applies it on its next cycle. A command that isn't applied in time is cancelled,
+ * so the control loop drops it instead of applying it late
+ */
+bool PoeCommandQueue::submit(PoeCommand command, PoeCommandResult& result, uint64_t timeout_us) {
+    PoeCommandSlot* slot;
+    {
+        std::lock_guard<std::mutex> guard(submit_lock);
+        command.seq = next_seq;
+        command.submit_us = monotonicUs();
+        slot = &slots[command.seq % POE_COMMANDS_CAPACITY];
+        std::lock_guard<std::mutex> slots_guard(slots_lock);
+        if (slot->seq != 0 || !commands.push(command)) {
+            result = {command.seq, 0, "Command queue is full"};
+            return false;
+        }
+        slot->seq = command.seq;
+        slot->state = PoeCommandState::QUEUED;
+        next_seq++;
+    }
+
+    std::unique_lock<std::mutex> guard(slots_lock);
+    bool done = slots_cv.wait_for(guard, std::chrono::microseconds(timeout_us),
+                                  [slot]() { return slot->state == PoeCommandState::DONE; });
+    if (!done && slot->state == PoeCommandState::QUEUED) {
+        /* The control loop frees the slot when it drops the command */
+        slot->state = PoeCommandState::CANCELLED;
+        result = {command.seq, 0, "Command wasn't applied in time and is cancelled"};
+        return false;
+    }
+    /* The control loop is applying it, its result comes right away */
+    slots_cv.wait(guard, [slot]() { return slot->state == PoeCommandState::DONE; });
+    result = slot->result;
+    slot->seq = 0;
+    return result.error == nullptr;
+}
+
+/* Take the command for the apply unless its socket thread has given up on it */
+bool PoeCommandQueue::take(const PoeCommand& command) {
+    std::lock_guard<std::mutex> guard(slots_lock);
+    PoeCommandSlot& slot = slots[command.seq % POE_COMMANDS_CAPACITY];
+    if (slot.state == PoeCommandState::CANCELLED) {
+        slot.seq = 0;
+        return false;
+    }
+    slot.state = PoeCommandState::APPLYING;
+    return true;
+}
+
+void PoeCommandQueue::complete(const PoeCommandResult& result) {
+    {
+        std::lock_guard<std::mutex> guard(slots_lock);
+        PoeCommandSlot& slot = slots[result.seq % POE_COMMANDS_CAPACITY];
+        slot.result = result;
+        slot.state = PoeCommandState::DONE;
+    }
+    slots_cv.notify_all();
+}
+
+static const char* applyCommand(std::vector<PoeController>& controllers, const PoeCommand& command) {
+    if (command.controller >= controllers.size()) {
+        return "Controller index is out of range";
+    }
+    PoeController& controller = controllers[command.controller];
+    PoePortsTelemetry& tm = controller.telemetry;
+    size_t port = command.port;
+    if (port == POE_COMMAND_NO_PORT ? command.kind != PoeCommandKind::SET_BUDGET : port >= controller.ports.size()) {
+        return "Port index is out of range";
+    }
+
+    switch (command.kind) {
+        case PoeCommandKind::SET_PORT_POWER:
+            if (command.value == 0.0) {
+                return controller.powerOff(port) ? nullptr : "Can't power off the port";
+            }
+            if (tm.mode[port] == (uint8_t)PoeMode::POE_OFF) {
+                return "Port mode is OFF";
+            }
+            /* The operator overrides the shed, the next cycle sheds the port again if it is still over budget */
+            tm.setFlag(port, POE_PORT_OVERBUDGET, false);
+            return controller.powerOn(port) ? nullptr : "Can't power on the port";
+        case PoeCommandKind::SET_MODE:
+            return controller.setPortMode(port, (PoeMode)(int)command.value, !tm.hasFlag(port, POE_PORT_OVERBUDGET)) ?
+                   nullptr : "Can't set the mode";
+        case PoeCommandKind::SET_BUDGET:
+            if (port == POE_COMMAND_NO_PORT) {
+                controller.total_budget = command.value;
+            } else {
+                tm.budget[port] = command.value;
+            }
+            return nullptr;
+        case PoeCommandKind::SET_PRIORITY:
+            tm.priority[port] = (int)command.value;
+            return nullptr;
+        default:
+            return "Unknown command";
+    }
+}
+
+/* Apply the queued commands, called by the control loop only before the cycle */
+size_t PoeCommandQueue::apply(std::vector<PoeController>& controllers) {
+    size_t applied = 0;
+    PoeCommand command;
+    while (commands.pop(command)) {
+        if (!take(command)) {
+            POE_LOG(STATE, LOG_WARNING, "Dropped %s %g of controller %u, the request has timed out\n",
+                    poeCommandKindToString(command.kind), command.value, (unsigned)command.controller);
+            continue;
+        }
+        PoeCommandResult result;
+        result.seq = command.seq;
+        result.error = applyCommand(controllers, command);
+        result.latency_us = monotonicUs() - command.submit_us;
+        poe_stats.commands.add();
+        poe_stats.command_latency.add(result.latency_us);
+        if (result.error == nullptr) {
+            POE_LOG(STATE, LOG_NOTICE, "Applied %s %g to port %d of controller %u in %llu us\n",
+                    poeCommandKindToString(command.kind), command.value,
+                    command.port == POE_COMMAND_NO_PORT ? -1 : (int)command.port, (unsigned)command.controller,
+                    (unsigned long long)result.latency_us);
+        } else {
+            POE_LOG(STATE, LOG_ERR, "Can't apply %s %g to port %d of controller %u: %s\n",
+                    poeCommandKindToString(command.kind), command.value,
+                    command.port == POE_COMMAND_NO_PORT ? -1 : (int)command.port, (unsigned)command.controller,
+                    result.error);
+        }
+        complete(result);
+        applied++;
+    }
+    return applied;
+}
@@ -15,147 +15,323 @@
  */
 
 #include "poe_controller.h"
+#include "logs.h"
+#include "poe_record.h"
 #include "poe_simulator.h"
-#include <syslog.h>
-
-static map<string, enum PoeState> states = {
-        {"0(NONE)", PoeState::NONE},
-        {"1(DCP)", PoeState::DCP},
-        {"2(HIGH_CAP)", PoeState::HIGH_CAP},
-        {"3(RLOW)", PoeState::RLOW},
-        {"4(DET_OK)", PoeState::DET_OK},
-        {"5(RHIGH)", PoeState::RHIGH},
-        {"6(OPEN)", PoeState::OPEN},
-        {"7(DCN)", PoeState::DCN}
-};
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+
+#define POE_LINE_MAX_TOKENS    5
+
+void PoePortsTelemetry::resize(size_t size) {
+    voltage.resize(size, 0.0);
+    current.resize(size, 0.0);
+    power.resize(size, 0.0);
+    budget.resize(size, 0.0);
+    hysteresis.resize(size, POE_DEFAULT_HYSTERESIS);
+    priority.resize(size, 0);
+    state.resize(size, (uint8_t)PoeState::NONE);
+    poe_class.resize(size, 0);
+    mode.resize(size, (uint8_t)PoeMode::POE_OFF);
+    flags.resize(size, 0);
+    prev_power.resize(size, 0.0);
+    energy_uj.resize(size);
+}
+
+void PoePortsTelemetry::setFlag(size_t port, uint8_t flag, bool value) {
+    uint8_t old_flags = flags[port];
+    if (value) {
+        flags[port] |= flag;
+    } else {
+        flags[port] &= ~flag;
+    }
+    if ((old_flags ^ flags[port]) & POE_PORT_CHECKPOINTED) {
+        checkpoint_gen++;
+    }
+}
 
 PoePort::PoePort() {
     index = 0;
-    priority = 0;
-    voltage = 0.0;
-    current = 0.0;
-    power = 0.0;
-    enable_flag = false;
-    enable_perm = false;
-    overbudget_flag = false;
-    state = PoeState::NONE;
-    mode = PoeMode::POE_OFF;
-    budget = 0.0;
     test_mode = false;
+    hw_mode = PoeMode::POE_OFF;
+    shed_cnt = 0;
+    restore_cnt = 0;
+    flap_cnt = 0;
+    last_restore_us = 0;
+    restore_backoff_us = 0;
+    next_restore_us = 0;
 }
 
-bool PoePort::getData() {
-    string portinfo_path = contr_path + string("/port_info");
-    string portinfo;
-    string port_params_str;
-    string portstat_path = contr_path + string("/port_status");
-    string portstat;
-    string port_status_str;
-    if (test_mode) {
-        /* Get simulated PoE data */
-        vector<string> sim_data = this->port_sim.getData();
-        if (sim_data.empty()) {
-            syslog(LOG_ERR, "There is no simulated data in test mode\n");
-            return false;
-        }
-        port_params_str = sim_data.at(0);
-        port_status_str = sim_data.at(1);
+void PoePort::initSim(enum PoeMode mode) {
+    double working_voltage = 0.0;
+    if (mode == PoeMode::POE_48V ||
+            mode == PoeMode::POE_AUTO) {
+        working_voltage = 48.0;
     } else {
-        /* Read real values */
-        try {
-            portinfo = cat(portinfo_path);
-        } catch (const exception& e) {
-            syslog(LOG_ERR, "Path %s can not be opened\n", portinfo_path.c_str());
-            return false;
+        working_voltage = 24.0;
+    }
+    double voltage_var = PoeSimProfile::generateRandomDouble(0.0, 1.5);
+    double current_init = PoeSimProfile::generateRandomDouble(0.1, 0.2);
+    double current_var = PoeSimProfile::generateRandomDouble(0.0, 0.1);
+    double current_inc = PoeSimProfile::generateRandomDouble(0.0, 0.04);
+
+    port_sim.addProfile(PoeSimProfile(PoeSimProfile::generateRandomNumber(10, 30),
+                                      working_voltage, voltage_var,
+                                      current_init, current_var, current_inc,
+                                      "4(DET_OK)", "6(0)"));
+    port_sim.addProfile(PoeSimProfile(PoeSimProfile::generateRandomNumber(10, 30),
+                                      0.0, 0.0,
+                                      0.0, 0.0, 0.0,
+                                      "6(OPEN)", "0(Unknown)"));
+    port_sim.addProfile(PoeSimProfile(PoeSimProfile::generateRandomNumber(10, 30),
+                                      working_voltage, voltage_var,
+                                      current_init, current_var, current_inc,
+                                      "4(DET_OK)", "6(0)"));
+
+    if (mode == PoeMode::POE_OFF) {
+        port_sim.turnOff();
+    }
+}
+
+/* Class code is the leading digit of the class reported by the driver, i.e. "6(0)" */
+static uint8_t parsePoeClassCode(const string& load_type) {
+    if (load_type.empty() || load_type[0] < '0' || load_type[0] > '9') {
+        return 0;
+    }
+    return load_type[0] - '0';
+}
+
+void PoeController::resizePorts(size_t size) {
+    ports.resize(size);
+    for (size_t i = 0; i < size; i++) {
+        ports[i].index = i;
+    }
+    telemetry.resize(size);
+}
+
+/* Take the next simulated sample of the test mode port, there is nothing to parse */
+bool PoeController::simulatePortData(size_t port) {
+    PoeSimSample sample;
+    if (!ports[port].port_sim.getSample(sample)) {
+        POE_LOG(HARDWARE, LOG_ERR, "There is no simulated data in test mode\n");
+        return false;
+    }
+    telemetry.state[port] = (uint8_t)sample.state;
+    telemetry.voltage[port] = sample.voltage;
+    telemetry.current[port] = sample.current;
+    telemetry.power[port] = sample.voltage * sample.current;
+    if (ports[port].load_type_str != *sample.class_str) {
+        ports[port].load_type_str = *sample.class_str;
+        telemetry.poe_class[port] = parsePoeClassCode(ports[port].load_type_str);
+    }
+    return true;
+}
+
+/* Split the driver line into space separated tokens without copying, returns the number of tokens found */
+static size_t splitLine(const string& line, const char* tokens[], size_t lens[], size_t max_tokens) {
+    size_t count = 0;
+    size_t pos = 0;
+    while (count < max_tokens) {
+        while (pos < line.size() && isspace((unsigned char)line[pos])) {
+            pos++;
         }
-        try {
-            portstat = cat(portstat_path);
-        } catch (const exception& e) {
-            syslog(LOG_ERR, "Path %s can not be opened\n", portstat_path.c_str());
-            return false;
+        if (pos >= line.size()) {
+            break;
         }
-        port_params_str = getLineByIndex(portinfo, index, '#'); //i.e: 0 eth14 auto 0.0 0.000
-        port_status_str = getLineByIndex(portstat, index, '#'); //i.e: 0 eth14 6(OPEN) 0(Unknown)
+        size_t start = pos;
+        while (pos < line.size() && !isspace((unsigned char)line[pos])) {
+            pos++;
+        }
+        tokens[count] = line.c_str() + start;
+        lens[count] = pos - start;
+        count++;
+    }
+    return count;
+}
+
+/* The whole token must be a number */
+static bool parseDoubleToken(const char* token, size_t len, double& value) {
+    if (len == 0) {
+        return false;
     }
+    char* end = nullptr;
+    value = strtod(token, &end);
+    return end == token + len;
+}
 
-    mode_str = getSubstringByIndex(port_params_str, 2);
-    voltage_str = getSubstringByIndex(port_params_str, 3);
-    current_str = getSubstringByIndex(port_params_str, 4);
-    state_str = getSubstringByIndex(port_status_str, 2);
-    load_type_str = getSubstringByIndex(port_status_str, 3);
+/* Tokens of one driver line of the port */
+struct PoeDriverLine {
+    const string& text;
+    const char* tokens[POE_LINE_MAX_TOKENS];
+    size_t lens[POE_LINE_MAX_TOKENS];
+    size_t count;
 
-//    cout << this->name << ": " << port_params_str;
-//    cout << this->name << ": " << port_status_str;
+    explicit PoeDriverLine(const string& line) : text(line) {
+        count = splitLine(line, tokens, lens, POE_LINE_MAX_TOKENS);
+    }
+};
+
+/* Text column of the driver line, the column may be missing */
+struct PoeDriverToken {
+    const char* token;
+    size_t len;
+};
 
-    state = states[state_str];
-    voltage = stod(voltage_str);
-    current = stod(current_str);
-    power = voltage * current;
+static bool parseDriverColumn(const PoeDriverLine& line, size_t column, double& value) {
+    return column < line.count && parseDoubleToken(line.tokens[column], line.lens[column], value);
+}
+
+static bool parseDriverColumn(const PoeDriverLine& line, size_t column, PoeState& value) {
+    return column < line.count && parsePoeState(line.tokens[column], line.lens[column], value);
+}
+
+static bool parseDriverColumn(const PoeDriverLine& line, size_t column, PoeDriverToken& value) {
+    value.token = column < line.count ? line.tokens[column] : "";
+    value.len = column < line.count ? line.lens[column] : 0;
     return true;
 }
 
-bool PoePort::powerOff() {
-    if (test_mode) {
-        port_sim.turnOff();
-        syslog(LOG_DEBUG, "Simulated PoE port %d power off, controller %s\n",
-               index, contr_path.c_str());
-        enable_flag = false;
+static void assignDriverValue(double& field, double value) {
+    field = value;
+}
+
+static void assignDriverValue(uint8_t& field, PoeState value) {
+    field = (uint8_t)value;
+}
+
+/* Strings rarely change, keep the string unless it does */
+static void assignDriverValue(string& field, const PoeDriverToken& value) {
+    if (field.size() != value.len || field.compare(0, value.len, value.token, value.len) != 0) {
+        field.assign(value.token, value.len);
+    }
+}
+
+/* The parsed driver fields of POE_PORT_FIELDS, NONE fields are not read from the driver */
+#define POE_DRIVER_TYPE_DOUBLE double
+#define POE_DRIVER_TYPE_STATE PoeState
+#define POE_DRIVER_TYPE_STRING PoeDriverToken
+#define POE_DRIVER_MEMBER_NONE(id, kind)
+#define POE_DRIVER_MEMBER_INFO(id, kind) POE_DRIVER_TYPE_##kind id;
+#define POE_DRIVER_MEMBER_STATUS(id, kind) POE_DRIVER_TYPE_##kind id;
+#define POE_DRIVER_MEMBER(id, kind, json, metric, unit, help, value, source, column) \
+    POE_DRIVER_MEMBER_##source(id, kind)
+
+struct PoeDriverFields {
+    POE_PORT_FIELDS(POE_DRIVER_MEMBER)
+};
+
+#define POE_DRIVER_PARSE_NONE(id, column)
+#define POE_DRIVER_PARSE_INFO(id, column) POE_DRIVER_PARSE_LINE(id, info, column)
+#define POE_DRIVER_PARSE_STATUS(id, column) POE_DRIVER_PARSE_LINE(id, status, column)
+#define POE_DRIVER_PARSE_LINE(id, line, column) \
+    if (!parseDriverColumn(line, column, fields.id)) { \
+        POE_LOG(HARDWARE, LOG_ERR, "Port %zu of controller %s has malformed %s: '%s'\n", \
+                port, path.c_str(), #id, line.text.c_str()); \
+        return false; \
+    }
+#define POE_DRIVER_PARSE(id, kind, json, metric, unit, help, value, source, column) \
+    POE_DRIVER_PARSE_##source(id, column)
+
+#define POE_DRIVER_ASSIGN_NONE(id, value)
+#define POE_DRIVER_ASSIGN_INFO(id, value) assignDriverValue(value, fields.id);
+#define POE_DRIVER_ASSIGN_STATUS(id, value) assignDriverValue(value, fields.id);
+#define POE_DRIVER_ASSIGN(id, kind, json, metric, unit, help, value, source, column) \
+    POE_DRIVER_ASSIGN_##source(id, value)
+
+/* Parse "0 eth14 auto 0.0 0.000" and "0 eth14 6(OPEN) 0(Unknown)" lines of the port,
+ * the columns of the fields come from POE_PORT_FIELDS
+ */
+bool PoeController::parsePortData(size_t port, const string& port_params_str, const string& port_status_str) {
+    PoeDriverLine info(port_params_str);
+    PoeDriverLine status(port_status_str);
+
+    /* Reject malformed lines before writing anything instead of acting on garbage values */
+    PoeDriverFields fields;
+    POE_PORT_FIELDS(POE_DRIVER_PARSE)
+
+    PoeController& c = *this;
+    size_t i = port;
+    POE_PORT_FIELDS(POE_DRIVER_ASSIGN)
+
+    /* Derived values and the driver mode, which is not a port field */
+    telemetry.power[port] = telemetry.voltage[port] * telemetry.current[port];
+    telemetry.poe_class[port] = parsePoeClassCode(ports[port].load_type_str);
+    ports[port].hw_mode = info.count > 2 ? parseHwPoeMode(info.tokens[2], info.lens[2]) : parseHwPoeMode("", 0);
+    return true;
+}
+
+bool PoeController::powerOff(size_t port) {
+    if (ports[port].test_mode) {
+        ports[port].port_sim.turnOff();
+        POE_LOG(PORT, LOG_DEBUG, "Simulated PoE port %zu power off, controller %s\n",
+                port, path.c_str());
+        telemetry.setFlag(port, POE_PORT_ENABLED, false);
         return true;
     }
 
-    string poe_off_path = contr_path + string("/port_power_off");
+    string poe_off_path = path + string("/port_power_off");
     try {
-        echo(poe_off_path, to_string(index));
-        syslog(LOG_DEBUG, "PoE port %d power off, controller %s\n", index, contr_path.c_str());
+        echo(poe_off_path, to_string(port));
+        POE_LOG(PORT, LOG_DEBUG, "PoE port %zu power off, controller %s\n", port, path.c_str());
     } catch (const exception& e) {
-        syslog(LOG_ERR, "Path %s can not be opened\n", poe_off_path.c_str());
+        POE_LOG(HARDWARE, LOG_ERR, "Path %s can not be opened\n", poe_off_path.c_str());
         return false;
     }
-    enable_flag = false;
+    telemetry.setFlag(port, POE_PORT_ENABLED, false);
     return true;
 }
 
-bool PoePort::powerOn() {
-    if (test_mode) {
-        port_sim.turnOn();
-        syslog(LOG_DEBUG, "Simulated PoE port %d power on, controller %s\n",
-               index, contr_path.c_str());
-        enable_flag = true;
+bool PoeController::powerOn(size_t port) {
+    if (ports[port].test_mode) {
+        ports[port].port_sim.turnOn();
+        POE_LOG(PORT, LOG_DEBUG, "Simulated PoE port %zu power on, controller %s\n",
+                port, path.c_str());
+        telemetry.setFlag(port, POE_PORT_ENABLED, true);
         return true;
     }
 
-    string poe_on_path = contr_path + string("/port_power_on");
+    string poe_on_path = path + string("/port_power_on");
     try {
-        echo(poe_on_path, to_string(index));
-        syslog(LOG_DEBUG, "PoE port %d power on, controller %s\n", index, contr_path.c_str());
+        echo(poe_on_path, to_string(port));
+        POE_LOG(PORT, LOG_DEBUG, "PoE port %zu power on, controller %s\n", port, path.c_str());
     } catch (const exception& e) {
-        syslog(LOG_ERR, "Path %s can not be opened\n", poe_on_path.c_str());
+        POE_LOG(HARDWARE, LOG_ERR, "Path %s can not be opened\n", poe_on_path.c_str());
         return false;
     }
-    enable_flag = true;
+    telemetry.setFlag(port, POE_PORT_ENABLED, true);
     return true;
 }
 
-bool PoePort::setMode(enum PoeMode new_mode) {
-    syslog(LOG_INFO, "Set mode %s for PoE port %d, controller %s\n",
-           poeModeToString(new_mode).c_str(), index, contr_path.c_str());
+/* Write the mode and power the port on, a port shed before the restart gets the mode but stays off */
+bool PoeController::setPortMode(size_t port, enum PoeMode new_mode, bool power_on) {
+    /* An unsupported mode must not leave the port powered off */
+    if (!isPoeModeSupported(new_mode)) {
+        POE_LOG(PORT, LOG_ERR, "Mode %s isn't supported, PoE port %zu, controller %s\n",
+                poeModeToString(new_mode).c_str(), port, path.c_str());
+        return false;
+    }
+    POE_LOG(PORT, LOG_INFO, "Set mode %s for PoE port %zu, controller %s\n",
+            poeModeToString(new_mode).c_str(), port, path.c_str());
 
-    string poe_mode_path = contr_path + string("/port_mode");
-    if (!powerOff()) {
+    string poe_mode_path = path + string("/port_mode");
+    if (!powerOff(port)) {
         return false;
     }
-    syslog(LOG_DEBUG, "PoE port %d power off, controller %s\n", index, contr_path.c_str());
+    POE_LOG(PORT, LOG_DEBUG, "PoE port %zu power off, controller %s\n", port, path.c_str());
 
+    bool test_mode = ports[port].test_mode;
     switch (new_mode) {
         case PoeMode::POE_OFF:
+            telemetry.mode[port] = (uint8_t)new_mode;
             return true;
         case PoeMode::POE_AUTO:
             if (!test_mode) {
                 try {
-                    echo(poe_mode_path, to_string(index) + string("auto"));
-                    syslog(LOG_DEBUG, "PoE port %d set mode auto, controller %s\n", index, contr_path.c_str());
+                    echo(poe_mode_path, to_string(port) + string("auto"));
+                    POE_LOG(PORT, LOG_DEBUG, "PoE port %zu set mode auto, controller %s\n", port, path.c_str());
                 } catch (const exception& e) {
-                    syslog(LOG_ERR, "Path %s can not be opened\n", poe_mode_path.c_str());
+                    POE_LOG(HARDWARE, LOG_ERR, "Path %s can not be opened\n", poe_mode_path.c_str());
                     return false;
                 }
             }
@@ -163,135 +339,223 @@ bool PoePort::setMode(enum PoeMode new_mode) {
         case PoeMode::POE_48V:
             if (!test_mode) {
                 try {
-                    echo(poe_mode_path, to_string(index) + string("manual"));
-                    syslog(LOG_DEBUG, "PoE port %d set mode manual, controller %s\n", index, contr_path.c_str());
+                    echo(poe_mode_path, to_string(port) + string("manual"));
+                    POE_LOG(PORT, LOG_DEBUG, "PoE port %zu set mode manual, controller %s\n", port, path.c_str());
                 } catch (const exception &e) {
-                    syslog(LOG_ERR, "Path %s can not be opened\n", poe_mode_path.c_str());
+                    POE_LOG(HARDWARE, LOG_ERR, "Path %s can not be opened\n", poe_mode_path.c_str());
                     return false;
                 }
             }
             break;
-        case PoeMode::POE_24V:
-            //TODO
-            return false;
         default:
             return false;
     }
 
-    if (!powerOn()) {
+    telemetry.mode[port] = (uint8_t)new_mode;
+    if (!power_on) {
+        return true;
+    }
+    if (!powerOn(port)) {
         return false;
     }
-    syslog(LOG_DEBUG, "PoE port %d power on, controller %s\n", index, contr_path.c_str());
-    this->mode = new_mode;
+    POE_LOG(PORT, LOG_DEBUG, "PoE port %zu power on, controller %s\n", port, path.c_str());
 
     return true;
 }
 
-void PoePort::initSim() {
-    double working_voltage = 0.0;
-    if (this->mode == PoeMode::POE_48V ||
-            this->mode == PoeMode::POE_AUTO) {
-        working_voltage = 48.0;
-    } else {
-        working_voltage = 24.0;
+/* Apply the mode only if the hardware doesn't already run it, so that restarts don't power cycle PDs.
+ * Port data must be acquired before the call
+ */
+bool PoeController::adoptPortMode(size_t port, enum PoeMode new_mode) {
+    bool shed = telemetry.hasFlag(port, POE_PORT_OVERBUDGET);
+    if (ports[port].test_mode || new_mode == PoeMode::POE_OFF || ports[port].hw_mode != new_mode || shed) {
+        return setPortMode(port, new_mode, !shed);
     }
-    double voltage_var = PoeSimProfile::generateRandomDouble(0.0, 1.5);
-    double current_init = PoeSimProfile::generateRandomDouble(0.1, 0.2);
-    double current_var = PoeSimProfile::generateRandomDouble(0.0, 0.1);
-    double current_inc = PoeSimProfile::generateRandomDouble(0.0, 0.04);
 
-    port_sim.addProfile(PoeSimProfile(PoeSimProfile::generateRandomNumber(10, 30),
-                                      working_voltage, voltage_var,
-                                      current_init, current_var, current_inc,
-                                      "4(DET_OK)", "6(0)"));
-    port_sim.addProfile(PoeSimProfile(PoeSimProfile::generateRandomNumber(10, 30),
-                                      0.0, 0.0,
-                                      0.0, 0.0, 0.0,
-                                      "6(OPEN)", "0(Unknown)"));
-    port_sim.addProfile(PoeSimProfile(PoeSimProfile::generateRandomNumber(10, 30),
-                                      working_voltage, voltage_var,
-                                      current_init, current_var, current_inc,
-                                      "4(DET_OK)", "6(0)"));
+    POE_LOG(PORT, LOG_INFO, "Adopt mode %s of PoE port %zu, controller %s\n",
+            poeModeToString(new_mode).c_str(), port, path.c_str());
+    telemetry.mode[port] = (uint8_t)new_mode;
 
-    if (this->mode == PoeMode::POE_OFF) {
-        port_sim.turnOff();
+    /* Port already delivers power, nothing to write */
+    if (telemetry.voltage[port] > 0.0) {
+        telemetry.setFlag(port, POE_PORT_ENABLED, true);
+        return true;
     }
+    return powerOn(port);
 }
 
 
-bool PoeController::getPortsData() {
-    for (auto& port: ports) {
-        if (!port.getData()) {
+bool PoeController::hasHwPorts() const {
+    for (const auto& port: ports) {
+        if (!port.test_mode) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Start the read of info and status of all the hardware ports at once, the reads of the controllers overlap */
+void PoeController::startReadPortsData() {
+    if (!hasHwPorts()) {
+        return;
+    }
+    if (!reader) {
+        reader = std::make_shared<PoeDriverReader>(path);
+    }
+    reader->start();
+}
+
+/* Wait for the read started by startReadPortsData() until the deadline of monotonicUs() */
+PoeReadResult PoeController::readPortsData(uint64_t deadline_us) {
+    if (!reader) {
+        return PoeReadResult::OK;
+    }
+    return reader->wait(deadline_us, port_info_raw, port_status_raw);
+}
+
+/* Parse the data got by readPortsData(), simulated ports get their data here */
+bool PoeController::parsePortsData() {
+    vector<string> info_lines = getLines(port_info_raw, '#');
+    vector<string> stat_lines = getLines(port_status_raw, '#');
+    for (size_t i = 0; i < ports.size(); i++) {
+        if (ports[i].test_mode) {
+            if (!simulatePortData(i)) {
+                return false;
+            }
+            continue;
+        }
+        if (i >= info_lines.size() || i >= stat_lines.size()) {
+            POE_LOG(HARDWARE, LOG_ERR, "There is no data of port %zu in controller %s\n", i, path.c_str());
+            return false;
+        }
+        if (!parsePortData(i, info_lines[i], stat_lines[i])) {
             return false;
         }
     }
     return true;
 }
 
-PoePort& PoeController::getLowesPrioPort() {
+bool PoeController::getPortsData() {
+    startReadPortsData();
+    return readPortsData(monotonicUs() + POE_CONTROLLER_READ_TIMEOUT_US) == PoeReadResult::OK && parsePortsData();
+}
+
+/* Integrate the power of the ports over the time between the samples with the trapezoidal rule,
+ * W by us gives uJ. The first sample only starts the integration
+ */
+void PoeController::accountEnergy(uint64_t sample_us) {
+    if (energy_sample_us != 0 && sample_us > energy_sample_us) {
+        double half_interval_us = (sample_us - energy_sample_us) * 0.5;
+        uint64_t total_uj = 0;
+        for (size_t i = 0; i < telemetry.size(); i++) {
+            double energy = (telemetry.prev_power[i] + telemetry.power[i]) * half_interval_us;
+            uint64_t port_uj = energy > 0.0 ? (uint64_t)llround(energy) : 0;
+            telemetry.energy_uj[i].add(port_uj);
+            total_uj += port_uj;
+        }
+        energy_uj.add(total_uj);
+    }
+    telemetry.prev_power = telemetry.power;
+    energy_sample_us = sample_us;
+}
+
+double PoeController::getTotalPower() const {
+    double total_power = 0.0;
+    for (double power: telemetry.power) {
+        total_power += power;
+    }
+    return total_power;
+}
+
+size_t PoeController::getLowesPrioPort() const {
     int lowest_prio = 0;
-    int lowest_prio_ind = 0;
-    for (int i = 0; i < ports.size(); i++) {
-        if (!ports.at(i).enable_flag) {
+    size_t lowest_prio_ind = 0;
+    for (size_t i = 0; i < telemetry.size(); i++) {
+        if (!(telemetry.flags[i] & POE_PORT_ENABLED)) {
             continue;
         }
-        if (ports.at(i).priority > lowest_prio) {
+        if (telemetry.priority[i] > lowest_prio) {
             lowest_prio_ind = i;
-            lowest_prio = ports.at(i).priority;
+            lowest_prio = telemetry.priority[i];
         }
     }
-    return ports.at(lowest_prio_ind);
+    return lowest_prio_ind;
 }
 
+#define POE_HEALTH_NAME(value, name) name,
 
+static const char* const health_names[] = {POE_CONTROLLER_HEALTHS(POE_HEALTH_NAME)};
 
-string poeStateToString(PoeState state) {
-    // Iterate over the map to find the corresponding string
-    for (const auto& pair : states) {
-        if (pair.second == state) {
-            return pair.first;  // Return the corresponding string
-        }
+const char* controllerHealthToString(ControllerHealth health) {
+    size_t ind = static_cast<size_t>(health);
+    return ind < static_cast<size_t>(ControllerHealth::COUNT) ? health_names[ind] : "unknown";
+}
+
+#define POE_STATE_NAME(value, name) name,
+#define POE_MODE_NAME(value, name, hw_name) name,
+#define POE_MODE_HW_NAME(value, name, hw_name) hw_name,
+
+static const string state_names[] = {POE_STATES(POE_STATE_NAME)};
+static const string mode_names[] = {POE_MODES(POE_MODE_NAME)};
+static const string mode_hw_names[] = {POE_MODES(POE_MODE_HW_NAME)};
+static const string unknown_name = "UNKNOWN";
+
+const string& poeStateToString(PoeState state) {
+    size_t ind = static_cast<size_t>(state);
+    if (ind >= static_cast<size_t>(PoeState::COUNT)) {
+        /* Log an error to syslog if the state is not found */
+        POE_LOG(GENERAL, LOG_ERR, "Invalid PoE state value. Returning 'UNKNOWN'.");
+        return unknown_name;
     }
+    return state_names[ind];
+}
 
-    // Log an error to syslog if the state is not found
-    syslog(LOG_ERR, "Invalid PoE state value. Returning 'UNKNOWN'.");
-    return "UNKNOWN";  // Return default string if not found
+/* The leading digit of the state name is its value, the rest must match too */
+bool parsePoeState(const char* name, size_t len, enum PoeState& state) {
+    if (len == 0 || name[0] < '0' || name[0] - '0' >= static_cast<int>(PoeState::COUNT)) {
+        return false;
+    }
+    size_t ind = name[0] - '0';
+    if (state_names[ind].size() != len || state_names[ind].compare(0, len, name, len) != 0) {
+        return false;
+    }
+    state = static_cast<PoeState>(ind);
+    return true;
 }
 
 enum PoeMode parsePoeMode(const string& mode) {
-    map<string, enum PoeMode> modes = {
-            {"AUTO", PoeMode::POE_AUTO},
-            {"48V", PoeMode::POE_48V},
-            {"24V", PoeMode::POE_24V},
-            {"OFF", PoeMode::POE_OFF}
-    };
-
-    /* Check if the mode exists in the map */
-    auto it = modes.find(mode);
-    if (it == modes.end()) {
-        /* Log an error to syslog if the mode is not found */
-        syslog(LOG_ERR, "Invalid PoE mode: %s. Defaulting to POE_OFF.", mode.c_str());
-        return PoeMode::POE_OFF;  // Return the default value POE_OFF
+    for (size_t i = 0; i < static_cast<size_t>(PoeMode::COUNT); i++) {
+        if (mode_names[i] == mode) {
+            return static_cast<PoeMode>(i);
+        }
+    }
+    /* Log an error to syslog if the mode is not found */
+    POE_LOG(GENERAL, LOG_ERR, "Invalid PoE mode: %s. Defaulting to POE_OFF.", mode.c_str());
+    return PoeMode::POE_OFF;  // Return the default value POE_OFF
+}
+
+/* Map the mode reported by the driver in port_info to the daemon's mode */
+enum PoeMode parseHwPoeMode(const char* mode, size_t len) {
+    for (size_t i = 0; i < static_cast<size_t>(PoeMode::COUNT); i++) {
+        if (!mode_hw_names[i].empty() && mode_hw_names[i].size() == len &&
+                mode_hw_names[i].compare(0, len, mode, len) == 0) {
+            return static_cast<PoeMode>(i);
+        }
     }
-    return it->second;  // Return the corresponding PoeMode value
+    return PoeMode::POE_OFF;
 }
 
-string poeModeToString(PoeMode mode) {
-    /* Map from PoeMode to string */
-    map<PoeMode, std::string> modeToStringMap = {
-            {PoeMode::POE_AUTO, "AUTO"},
-            {PoeMode::POE_48V, "48V"},
-            {PoeMode::POE_24V, "24V"},
-            {PoeMode::POE_OFF, "OFF"}
-    };
+/* Modes the driver can be set to, 24V isn't implemented */
+bool isPoeModeSupported(PoeMode mode) {
+    return mode == PoeMode::POE_OFF || mode == PoeMode::POE_AUTO || mode == PoeMode::POE_48V;
+}
 
-    /* Check if the mode exists in the map */
-    auto it = modeToStringMap.find(mode);
-    if (it == modeToStringMap.end()) {
+const string& poeModeToString(PoeMode mode) {
+    size_t ind = static_cast<size_t>(mode);
+    if (ind >= static_cast<size_t>(PoeMode::COUNT)) {
         /* Log an error to syslog if the mode is not found */
-        syslog(LOG_ERR, "Invalid PoE mode value. Returning 'UNKNOWN'.");
-        return "UNKNOWN";  // Return default string "UNKNOWN"
+        POE_LOG(GENERAL, LOG_ERR, "Invalid PoE mode value. Returning 'UNKNOWN'.");
+        return unknown_name;
     }
-
-    return it->second;  // Return the corresponding string value
-}
\ No newline at end of file
+    return mode_names[ind];
+}
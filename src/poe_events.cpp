@@ -0,0 +1,100 @@
+/*
+ * © 2024 Proxeet Limited
+ *
+ * The poed packet is licensed under the GNU Lesser General Public License version 3,
+ * published by the Free Software Foundation.
+ *
+ * You may use, distribute, and modify this code under the terms of the LGPLv3.
+ *
+ * The project is distributed WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU Lesser General Public License version 3 for more details.
+ *
+ * Author: Aleksey Vasilenko (a.vasilenko@proxeet.com)
+ */
+
+#include "poe_events.h"
+#include "poe_clock.h"
+#include <cstring>
+
+PoeEventJournal poe_events;
+
+#define POE_EVENT_KIND_NAME(value, name) name,
+
+static const char* const event_kind_names[] = {
+    POE_EVENT_KINDS(POE_EVENT_KIND_NAME)
+};
+
+const char* poeEventKindToString(PoeEventKind kind) {
+    size_t ind = static_cast<size_t>(kind);
+    return ind < static_cast<size_t>(PoeEventKind::COUNT) ? event_kind_names[ind] : "unknown";
+}
+
+PoeEventJournal::PoeEventJournal() {
+    for (Slot& slot: slots) {
+        for (auto& word: slot.words) {
+            word.store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+/* Called by the control loop only, the slot is marked odd for the time of the write */
+void PoeEventJournal::push(PoeEventKind kind, size_t controller, size_t port, double power, double budget,
+                           double total) {
+    PoeEvent event{};
+    event.seq = last_seq.load(std::memory_order_relaxed) + 1;
+    event.time_us = poe_clock->nowUs();
+    event.realtime_us = poe_clock->realtimeUs();
+    event.power = power;
+    event.budget = budget;
+    event.total = total;
+    event.controller = controller;
+    event.port = port;
+    event.kind = (uint8_t)kind;
+
+    uint64_t words[POE_EVENT_WORDS];
+    memcpy(words, &event, sizeof(event));
+    Slot& slot = slots[event.seq % POE_EVENTS_CAPACITY];
+    slot.version.store(2 * event.seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < POE_EVENT_WORDS; i++) {
+        slot.words[i].store(words[i], std::memory_order_relaxed);
+    }
+    slot.version.store(2 * event.seq, std::memory_order_release);
+    last_seq.store(event.seq, std::memory_order_release);
+}
+
+/* Append the events newer than since to the list, dropped counts the ones already overwritten.
+ * Returns the sequence of the last event in the journal to pass as since next time
+ */
+uint64_t PoeEventJournal::read(uint64_t since, std::vector<PoeEvent>& events, uint64_t& dropped) const {
+    uint64_t last = last_seq.load(std::memory_order_acquire);
+    dropped = 0;
+    if (since >= last) {
+        return last;
+    }
+    uint64_t first = since + 1;
+    if (last - since > POE_EVENTS_CAPACITY) {
+        first = last - POE_EVENTS_CAPACITY + 1;
+        dropped = first - since - 1;
+    }
+    for (uint64_t seq = first; seq <= last; seq++) {
+        const Slot& slot = slots[seq % POE_EVENTS_CAPACITY];
+        uint64_t version = slot.version.load(std::memory_order_acquire);
+        uint64_t words[POE_EVENT_WORDS];
+        for (size_t i = 0; i < POE_EVENT_WORDS; i++) {
+            words[i] = slot.words[i].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        /* The writer lapped the reader, the slot holds a newer event or is being written */
+        if (version != 2 * seq || slot.version.load(std::memory_order_relaxed) != version) {
+            dropped++;
+            continue;
+        }
+        PoeEvent event;
+        memcpy(&event, words, sizeof(event));
+        events.push_back(event);
+    }
+    return last;
+}
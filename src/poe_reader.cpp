@@ -0,0 +1,111 @@
+/*
+ * © 2024 Proxeet Limited
+ *
+ * The poed packet is licensed under the GNU Lesser General Public License version 3,
+ * published by the Free Software Foundation.
+ *
+ * You may use, distribute, and modify this code under the terms of the LGPLv3.
+ *
+ * The project is distributed WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU Lesser General Public License version 3 for more details.
+ *
+ * Author: Aleksey Vasilenko (a.vasilenko@proxeet.com)
+ */
+
+#include "poe_reader.h"
+#include "logs.h"
+#include "stats.h"
+#include "utils.h"
+#include <chrono>
+#include <thread>
+
+PoeDriverReader::PoeDriverReader(const std::string& path) : state(std::make_shared<State>()) {
+    state->path = path;
+    std::thread(&PoeDriverReader::run, state).detach();
+}
+
+PoeDriverReader::~PoeDriverReader() {
+    std::lock_guard<std::mutex> guard(state->lock);
+    state->stopped = true;
+    state->cv.notify_all();
+}
+
+void PoeDriverReader::run(std::shared_ptr<State> state) {
+    std::unique_lock<std::mutex> guard(state->lock);
+    for (;;) {
+        state->cv.wait(guard, [&]() { return state->requested || state->stopped; });
+        if (state->stopped) {
+            return;
+        }
+        state->requested = false;
+        state->busy = true;
+        std::string info_path = state->path + "/port_info";
+        std::string status_path = state->path + "/port_status";
+        guard.unlock();
+
+        std::string info;
+        std::string status;
+        std::string failed_path;
+        try {
+            info = cat(info_path);
+        } catch (const std::exception& e) {
+            failed_path = info_path;
+        }
+        if (failed_path.empty()) {
+            try {
+                status = cat(status_path);
+            } catch (const std::exception& e) {
+                failed_path = status_path;
+            }
+        }
+
+        guard.lock();
+        state->info.swap(info);
+        state->status.swap(status);
+        state->failed_path.swap(failed_path);
+        state->ok = state->failed_path.empty();
+        state->busy = false;
+        state->done = true;
+        state->cv.notify_all();
+    }
+}
+
+/* Start the read of the cycle, unless the previous one is still in the driver.
+ * A result left from a read which missed its deadline is stale and dropped
+ */
+void PoeDriverReader::start() {
+    std::lock_guard<std::mutex> guard(state->lock);
+    started = !state->busy && !state->requested;
+    if (!started) {
+        return;
+    }
+    state->done = false;
+    state->requested = true;
+    state->cv.notify_all();
+}
+
+/* Wait for the read started by start() until the deadline of the monotonic clock */
+PoeReadResult PoeDriverReader::wait(uint64_t deadline_us, std::string& info, std::string& status) {
+    std::unique_lock<std::mutex> guard(state->lock);
+    if (!started) {
+        POE_LOG(HARDWARE, LOG_ERR, "Previous read of controller %s is still in the driver\n", state->path.c_str());
+        return PoeReadResult::TIMEOUT;
+    }
+    uint64_t now_us = monotonicUs();
+    if (!state->cv.wait_for(guard, std::chrono::microseconds(deadline_us > now_us ? deadline_us - now_us : 0),
+                            [&]() { return state->done; })) {
+        POE_LOG(HARDWARE, LOG_ERR, "Read of controller %s missed its deadline\n", state->path.c_str());
+        return PoeReadResult::TIMEOUT;
+    }
+    started = false;
+    state->done = false;
+    if (!state->ok) {
+        POE_LOG(HARDWARE, LOG_ERR, "Path %s can not be opened\n", state->failed_path.c_str());
+        return PoeReadResult::FAILED;
+    }
+    info.swap(state->info);
+    status.swap(state->status);
+    return PoeReadResult::OK;
+}
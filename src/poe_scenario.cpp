@@ -0,0 +1,281 @@
+/*
+ * © 2024 Proxeet Limited
+ *
+ * The poed packet is licensed under the GNU Lesser General Public License version 3,
+ * published by the Free Software Foundation.
+ *
+ * You may use, distribute, and modify this code under the terms of the LGPLv3.
+ *
+ * The project is distributed WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU Lesser General Public License version 3 for more details.
+ *
+ * Author: Aleksey Vasilenko (a.vasilenko@proxeet.com)
+ */
+
+#include "poe_scenario.h"
+#include <cstdio>
+#include <fnmatch.h>
+#include <fstream>
+#include <syslog.h>
+
+using json = nlohmann::json;
+
+#define POE_SCENARIO_INRUSH_FACTOR    1.5
+#define POE_SCENARIO_DEFAULT_NOISE    0.02
+
+static const map<string, PoeScenarioPhaseType> phase_types = {
+        {"detect", PoeScenarioPhaseType::DETECT},
+        {"inrush", PoeScenarioPhaseType::INRUSH},
+        {"ramp", PoeScenarioPhaseType::RAMP},
+        {"step", PoeScenarioPhaseType::STEP},
+        {"disconnect", PoeScenarioPhaseType::DISCONNECT}
+};
+
+/* Power available to the PD of IEEE 802.3af/at/bt class, W */
+double getPoeClassPower(int poe_class) {
+    static const double class_power[] = {13.0, 3.84, 6.49, 13.0, 25.5, 40.0, 51.0, 62.0, 71.3};
+    if (poe_class < 0 || static_cast<size_t>(poe_class) >= sizeof(class_power) / sizeof(class_power[0])) {
+        return 0.0;
+    }
+    return class_power[poe_class];
+}
+
+bool PoeScenario::load(const string& path) {
+    ifstream file(path);
+    if (!file.is_open()) {
+        syslog(LOG_ERR, "Scenario %s can not be opened\n", path.c_str());
+        return false;
+    }
+    json scenario_json = json::parse(file, nullptr, false);
+    if (scenario_json.is_discarded() || !scenario_json.is_object()) {
+        syslog(LOG_ERR, "Scenario %s is not a valid JSON object\n", path.c_str());
+        return false;
+    }
+    return parse(scenario_json);
+}
+
+bool PoeScenario::parsePhase(const json& phase_json, int poe_class, PoeScenarioPhase& phase) {
+    auto type_it = phase_types.find(phase_json.value("type", string()));
+    if (type_it == phase_types.end()) {
+        syslog(LOG_ERR, "Scenario phase has unknown type: %s\n", phase_json.dump().c_str());
+        return false;
+    }
+    phase.type = type_it->second;
+    phase.steps = phase_json.value("steps", 0);
+    phase.voltage = phase_json.value("voltage", -1.0);
+    phase.voltage_noise = phase_json.value("voltage_noise", 0.5);
+    phase.noise = phase_json.value("noise", POE_SCENARIO_DEFAULT_NOISE);
+
+    double class_power = getPoeClassPower(poe_class);
+    switch (phase.type) {
+        case PoeScenarioPhaseType::INRUSH:
+            phase.power_from = phase_json.value("power", class_power * POE_SCENARIO_INRUSH_FACTOR);
+            phase.power_to = phase.power_from;
+            break;
+        case PoeScenarioPhaseType::STEP:
+            phase.power_from = phase_json.value("power", class_power);
+            phase.power_to = phase.power_from;
+            break;
+        case PoeScenarioPhaseType::RAMP:
+            phase.power_from = phase_json.value("from", 0.0);
+            phase.power_to = phase_json.value("to", class_power);
+            break;
+        default:
+            phase.power_from = 0.0;
+            phase.power_to = 0.0;
+            break;
+    }
+
+    if (phase.steps <= 0 || phase.power_from < 0.0 || phase.power_to < 0.0 ||
+            phase.voltage_noise < 0.0 || phase.noise < 0.0 || phase.noise >= 1.0) {
+        syslog(LOG_ERR, "Scenario phase has invalid parameters: %s\n", phase_json.dump().c_str());
+        return false;
+    }
+    return true;
+}
+
+bool PoeScenario::parse(const json& scenario_json) {
+    profiles.clear();
+    rules.clear();
+    try {
+        if (!scenario_json.contains("profiles") || !scenario_json["profiles"].is_object()) {
+            syslog(LOG_ERR, "Scenario has no profiles\n");
+            return false;
+        }
+        for (auto& item: scenario_json["profiles"].items()) {
+            const json& profile_json = item.value();
+            PoeScenarioProfile profile;
+            profile.poe_class = profile_json.value("class", 0);
+            profile.loop = profile_json.value("loop", true);
+            if (getPoeClassPower(profile.poe_class) == 0.0) {
+                syslog(LOG_ERR, "Scenario profile %s has invalid class %d\n",
+                       item.key().c_str(), profile.poe_class);
+                return false;
+            }
+            if (!profile_json.contains("phases") || !profile_json["phases"].is_array() ||
+                    profile_json["phases"].empty()) {
+                syslog(LOG_ERR, "Scenario profile %s has no phases\n", item.key().c_str());
+                return false;
+            }
+            for (auto& phase_json: profile_json["phases"]) {
+                PoeScenarioPhase phase{};
+                if (!parsePhase(phase_json, profile.poe_class, phase)) {
+                    return false;
+                }
+                profile.phases.push_back(phase);
+            }
+            profiles[item.key()] = profile;
+        }
+
+        if (!scenario_json.contains("ports") || !scenario_json["ports"].is_array()) {
+            syslog(LOG_ERR, "Scenario has no ports rules\n");
+            return false;
+        }
+        for (auto& rule_json: scenario_json["ports"]) {
+            PoeScenarioRule rule;
+            rule.match = rule_json.value("match", string("*"));
+            rule.profile = rule_json.value("profile", string());
+            rule.offset_steps = rule_json.value("offset_steps", 0);
+            rule.stagger_steps = rule_json.value("stagger_steps", 0);
+            rule.matched = 0;
+            if (profiles.find(rule.profile) == profiles.end()) {
+                syslog(LOG_ERR, "Scenario rule refers to unknown profile '%s'\n", rule.profile.c_str());
+                return false;
+            }
+            if (rule.offset_steps < 0 || rule.stagger_steps < 0) {
+                syslog(LOG_ERR, "Scenario rule has invalid offset: %s\n", rule_json.dump().c_str());
+                return false;
+            }
+            rules.push_back(rule);
+        }
+    } catch (const exception& e) {
+        syslog(LOG_ERR, "Scenario parsing error: %s\n", e.what());
+        return false;
+    }
+    return true;
+}
+
+/* Replace the simulation of the port with the profile of the first rule matching its name,
+ * false if no rule matches
+ */
+bool PoeScenario::apply(PoePort& port, enum PoeMode mode) {
+    PoeScenarioRule* rule = nullptr;
+    for (auto& r: rules) {
+        if (fnmatch(r.match.c_str(), port.name.c_str(), 0) == 0) {
+            rule = &r;
+            break;
+        }
+    }
+    if (rule == nullptr) {
+        return false;
+    }
+    const PoeScenarioProfile& profile = profiles.at(rule->profile);
+
+    double working_voltage = 24.0;
+    if (mode == PoeMode::POE_48V || mode == PoeMode::POE_AUTO) {
+        working_voltage = 48.0;
+    }
+    string class_str = to_string(profile.poe_class) + "(" + to_string(profile.poe_class) + ")";
+
+    PoePortSim sim;
+    sim.setLoop(profile.loop);
+    int offset = rule->offset_steps + rule->stagger_steps * rule->matched;
+    if (offset > 0) {
+        sim.addProfile(PoeSimProfile(offset, 0.0, 0.0, 0.0, 0.0, 0.0, "6(OPEN)", "0(Unknown)"));
+    }
+    for (const auto& phase: profile.phases) {
+        double voltage = phase.voltage < 0.0 ? working_voltage : phase.voltage;
+        switch (phase.type) {
+            case PoeScenarioPhaseType::DETECT:
+                sim.addProfile(PoeSimProfile(phase.steps, 0.0, 0.0, 0.0, 0.0, 0.0, "4(DET_OK)", class_str));
+                break;
+            case PoeScenarioPhaseType::DISCONNECT:
+                sim.addProfile(PoeSimProfile(phase.steps, 0.0, 0.0, 0.0, 0.0, 0.0, "6(OPEN)", "0(Unknown)"));
+                break;
+            default: {
+                /* Loads are given in W, the simulator works with current */
+                double current_from = voltage > 0.0 ? phase.power_from / voltage : 0.0;
+                double current_to = voltage > 0.0 ? phase.power_to / voltage : 0.0;
+                double current_inc = phase.steps > 1 ? (current_to - current_from) / (phase.steps - 1) : 0.0;
+                double current_var = max(current_from, current_to) * phase.noise;
+                sim.addProfile(PoeSimProfile(phase.steps, voltage, phase.voltage_noise,
+                                             current_from, current_var, current_inc,
+                                             "4(DET_OK)", class_str));
+                break;
+            }
+        }
+    }
+    rule->matched++;
+
+    port.port_sim = sim;
+    if (mode == PoeMode::POE_OFF) {
+        port.port_sim.turnOff();
+    }
+    return true;
+}
+
+/* Replace the controllers and ports of the config with generated ones, spec is "<controllers>x<ports>".
+ * Budgets, priorities and modes are drawn from the simulation PRNG, so the seed replays the topology
+ */
+bool generateSimTopology(const string& spec, PoedConfig& config) {
+    unsigned long controllers_num = 0;
+    unsigned long ports_num = 0;
+    char tail = 0;
+    if (sscanf(spec.c_str(), "%lux%lu%c", &controllers_num, &ports_num, &tail) != 2 ||
+            controllers_num == 0 || ports_num == 0) {
+        syslog(LOG_ERR, "Invalid simulation topology '%s', expected <controllers>x<ports>\n", spec.c_str());
+        return false;
+    }
+    if (controllers_num > POE_CONTROLLERS_MAX || ports_num > POE_CONTROLLER_PORTS_MAX) {
+        syslog(LOG_ERR, "Simulation topology '%s' is over the limit of %d controllers with %d ports\n",
+               spec.c_str(), POE_CONTROLLERS_MAX, POE_CONTROLLER_PORTS_MAX);
+        return false;
+    }
+
+    /* Port budgets of 802.3af/at/bt PSEs and their shares in the fleet */
+    static const double port_budgets[] = {15.4, 30.0, 60.0, 90.0};
+    static const int port_budget_weights[] = {50, 35, 10, 5};
+    /* Controllers are oversubscribed, not every port can draw its whole budget at once */
+    static const double controller_oversubscription = 0.6;
+
+    config.clearTopology();
+    config.controllers.reserve(controllers_num);
+    config.ports.reserve(controllers_num * ports_num);
+    config.port_names.reserve(controllers_num * ports_num);
+    vector<PortConfig> ports(ports_num);
+    for (unsigned long c = 0; c < controllers_num; c++) {
+        double controller_budget = 0.0;
+        for (unsigned long p = 0; p < ports_num; p++) {
+            int weight = PoeSimProfile::generateRandomNumber(0, 99);
+            size_t budget_ind = 0;
+            while (weight >= port_budget_weights[budget_ind]) {
+                weight -= port_budget_weights[budget_ind];
+                budget_ind++;
+            }
+
+            int mode_draw = PoeSimProfile::generateRandomNumber(0, 99);
+            PoeMode mode = mode_draw < 90 ? PoeMode::POE_AUTO : (mode_draw < 95 ? PoeMode::POE_48V : PoeMode::POE_OFF);
+
+            PortConfig& port = ports[p];
+            port.name = "c" + to_string(c) + "eth" + to_string(p);
+            port.controller = c;
+            port.index = p;
+            port.budget = port_budgets[budget_ind];
+            port.priority = PoeSimProfile::generateRandomNumber(1, 4);
+            port.mode = mode;
+            controller_budget += port_budgets[budget_ind];
+        }
+
+        config.addController("/sim/controller" + to_string(c), ports_num,
+                             controller_budget * controller_oversubscription);
+        for (const auto& port: ports) {
+            config.addPort(port);
+        }
+    }
+
+    syslog(LOG_INFO, "Generated simulation topology of %lu controllers with %lu ports each\n",
+           controllers_num, ports_num);
+    return true;
+}
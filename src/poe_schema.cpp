@@ -0,0 +1,94 @@
+/*
+ * © 2024 Proxeet Limited
+ *
+ * The poed packet is licensed under the GNU Lesser General Public License version 3,
+ * published by the Free Software Foundation.
+ *
+ * You may use, distribute, and modify this code under the terms of the LGPLv3.
+ *
+ * The project is distributed WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU Lesser General Public License version 3 for more details.
+ *
+ * Author: Aleksey Vasilenko (a.vasilenko@proxeet.com)
+ */
+
+#include "poe_schema.h"
+#include <cstring>
+
+/* Hashes of the names are case labels, so a collision of two fields doesn't compile */
+#define POE_FIELD_FIND(id, ...) \
+    case poeFieldHash(#id): \
+        if (name == #id) { \
+            field = PoePortField::id; \
+            return true; \
+        } \
+        return false;
+
+bool findPortField(const string& name, PoePortField& field) {
+    switch (poeFieldHash(name.c_str())) {
+        POE_PORT_FIELDS(POE_FIELD_FIND)
+        default:
+            return false;
+    }
+}
+
+#define POE_JSON_DOUBLE(j, id, value)     j[#id] = value;
+#define POE_JSON_INT(j, id, value)        j[#id] = value;
+#define POE_JSON_BOOL(j, id, value)       j[#id] = value;
+#define POE_JSON_STATE(j, id, value)      j[#id] = poeStateToString((PoeState)(value));
+#define POE_JSON_MODE(j, id, value)       j[#id] = poeModeToString((PoeMode)(value));
+#define POE_JSON_STRING(j, id, value)     j[#id] = value;
+#define POE_JSON_COUNTER(j, id, value)    j[#id] = value;
+#define POE_JSON_ENERGY(j, id, value)     j[#id] = value;
+#define POE_FIELD_JSON(id, kind, json, metric, unit, help, value, ...) \
+    case PoePortField::id: \
+        POE_JSON_##kind(j_port, id, value) \
+        break;
+
+void writePortFieldJson(PoePortField field, nlohmann::json& j_port, const PoeController& c, size_t i) {
+    switch (field) {
+        POE_PORT_FIELDS(POE_FIELD_JSON)
+        default:
+            break;
+    }
+}
+
+#define POE_VALUE_DOUBLE(value)     (double)(value)
+#define POE_VALUE_INT(value)        (double)(value)
+#define POE_VALUE_BOOL(value)       ((value) ? 1.0 : 0.0)
+#define POE_VALUE_STATE(value)      (double)(value)
+#define POE_VALUE_MODE(value)       (double)(value)
+#define POE_VALUE_STRING(value)     0.0
+#define POE_VALUE_COUNTER(value)    (double)(value)
+#define POE_VALUE_ENERGY(value)     ((value) / 1e6)
+#define POE_FIELD_VALUE(id, kind, json, metric, unit, help, value, ...) \
+    case PoePortField::id: \
+        return POE_VALUE_##kind(value);
+
+/* Numeric value of the field for the metrics in the base units, strings have none */
+double getPortFieldValue(PoePortField field, const PoeController& c, size_t i) {
+    switch (field) {
+        POE_PORT_FIELDS(POE_FIELD_VALUE)
+        default:
+            return 0.0;
+    }
+}
+
+#define POE_RECORD_SET_DOUBLE(member, value)     member = value;
+#define POE_RECORD_SET_INT(member, value)        member = value;
+#define POE_RECORD_SET_BOOL(member, value)       member = (value) ? 1 : 0;
+#define POE_RECORD_SET_STATE(member, value)      member = value;
+#define POE_RECORD_SET_MODE(member, value)       member = value;
+#define POE_RECORD_SET_STRING(member, value) \
+    strncpy(member, (value).c_str(), POE_RECORD_STR_LEN - 1); \
+    member[POE_RECORD_STR_LEN - 1] = '\0';
+#define POE_RECORD_SET_COUNTER(member, value)    member = value;
+#define POE_RECORD_SET_ENERGY(member, value)     member = value;
+#define POE_FIELD_RECORD(id, kind, json, metric, unit, help, value, ...) \
+    POE_RECORD_SET_##kind(record.id, value)
+
+void encodePortRecord(const PoeController& c, size_t i, PoePortRecord& record) {
+    POE_PORT_FIELDS(POE_FIELD_RECORD)
+}
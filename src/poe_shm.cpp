@@ -0,0 +1,164 @@
+/*
+ * © 2024 Proxeet Limited
+ *
+ * The poed packet is licensed under the GNU Lesser General Public License version 3,
+ * published by the Free Software Foundation.
+ *
+ * You may use, distribute, and modify this code under the terms of the LGPLv3.
+ *
+ * The project is distributed WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU Lesser General Public License version 3 for more details.
+ *
+ * Author: Aleksey Vasilenko (a.vasilenko@proxeet.com)
+ */
+
+
+#include "poe_shm.h"
+#include "poe_schema.h"
+#include "poe_clock.h"
+#include "logs.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+PoeShm poe_shm;
+
+PoeShm::~PoeShm() {
+    close();
+}
+
+/* Tell the readers still mapping the segment of a previous run that it is not updated anymore */
+static void closeStaleSegment(const std::string& name) {
+    int fd = shm_open(name.c_str(), O_RDWR | O_CLOEXEC, 0);
+    if (fd < 0) {
+        return;
+    }
+    struct stat st{};
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(PoedShmHeader)) {
+        void* ptr = mmap(nullptr, sizeof(PoedShmHeader), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (ptr != MAP_FAILED) {
+            PoedShmHeader* h = static_cast<PoedShmHeader*>(ptr);
+            if (h->magic == POED_SHM_MAGIC && h->version == POED_SHM_VERSION) {
+                uint64_t seq = h->seq.load(std::memory_order_relaxed) | 1;
+                h->seq.store(seq, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+                h->closed = 1;
+                h->seq.store(seq + 1, std::memory_order_release);
+            }
+            munmap(ptr, sizeof(PoedShmHeader));
+        }
+    }
+    ::close(fd);
+    shm_unlink(name.c_str());
+}
+
+/* Create the segment for the ports of the controllers, the set of the ports doesn't change after startup */
+bool PoeShm::open(const std::string& name, const std::vector<PoeController>& controllers) {
+    close();
+    closeStaleSegment(name);
+
+    size_t ports = 0;
+    for (const auto& controller: controllers) {
+        ports += controller.ports.size();
+    }
+    size_t size = sizeof(PoedShmHeader) + controllers.size() * sizeof(PoedShmController) +
+                  ports * sizeof(PoePortRecord);
+
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        POE_LOG(STATE, LOG_ERR, "Can't create shared memory %s: %s\n", name.c_str(), strerror(errno));
+        return false;
+    }
+    /* Readers are local agents of any user, so the mode doesn't depend on the umask */
+    if (fchmod(fd, 0644) != 0 || ftruncate(fd, size) != 0) {
+        POE_LOG(STATE, LOG_ERR, "Can't size shared memory %s: %s\n", name.c_str(), strerror(errno));
+        ::close(fd);
+        shm_unlink(name.c_str());
+        return false;
+    }
+    void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (ptr == MAP_FAILED) {
+        POE_LOG(STATE, LOG_ERR, "Can't map shared memory %s: %s\n", name.c_str(), strerror(errno));
+        shm_unlink(name.c_str());
+        return false;
+    }
+    map = static_cast<uint8_t*>(ptr);
+    map_size = size;
+    this->name = name;
+
+    /* The memory is zeroed, so only the layout and the port ranges of the controllers are set */
+    PoedShmController* shm_controllers = reinterpret_cast<PoedShmController*>(map + sizeof(PoedShmHeader));
+    uint32_t first_port = 0;
+    for (size_t c = 0; c < controllers.size(); c++) {
+        shm_controllers[c].first_port = first_port;
+        shm_controllers[c].ports = controllers[c].ports.size();
+        first_port += controllers[c].ports.size();
+    }
+    PoedShmHeader* h = header();
+    h->version = POED_SHM_VERSION;
+    h->header_size = sizeof(PoedShmHeader);
+    h->controller_size = sizeof(PoedShmController);
+    h->record_size = sizeof(PoePortRecord);
+    h->controllers = controllers.size();
+    h->ports = ports;
+    h->size = size;
+    std::atomic_thread_fence(std::memory_order_release);
+    h->magic = POED_SHM_MAGIC;
+
+    POE_LOG(STATE, LOG_INFO, "Publishing snapshots of %zu ports to shared memory %s\n", ports, name.c_str());
+    return true;
+}
+
+/* Write the snapshot of the cycle under the seqlock, called from the control loop only */
+void PoeShm::publish(const std::vector<PoeController>& controllers, uint64_t cycle) {
+    if (map == nullptr) {
+        return;
+    }
+    PoedShmHeader* h = header();
+    uint64_t seq = h->seq.load(std::memory_order_relaxed);
+    h->seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    h->cycle = cycle;
+    h->time_us = poe_clock->nowUs();
+    h->realtime_us = poe_clock->realtimeUs();
+    PoedShmController* shm_controllers = reinterpret_cast<PoedShmController*>(map + sizeof(PoedShmHeader));
+    PoePortRecord* records = reinterpret_cast<PoePortRecord*>(map + sizeof(PoedShmHeader) +
+                                                              h->controllers * sizeof(PoedShmController));
+    size_t controllers_num = std::min(controllers.size(), (size_t)h->controllers);
+    for (size_t c = 0; c < controllers_num; c++) {
+        const PoeController& controller = controllers[c];
+        PoedShmController& shm_controller = shm_controllers[c];
+        shm_controller.total_budget = controller.total_budget;
+        shm_controller.total_power = controller.getTotalPower();
+        shm_controller.energy_uj = controller.energy_uj.get();
+        shm_controller.health = (uint8_t)controller.health;
+        size_t ports_num = std::min(controller.ports.size(), (size_t)shm_controller.ports);
+        for (size_t i = 0; i < ports_num; i++) {
+            encodePortRecord(controller, i, records[shm_controller.first_port + i]);
+        }
+    }
+
+    h->seq.store(seq + 2, std::memory_order_release);
+}
+
+/* Mark the segment closed for the readers and remove it */
+void PoeShm::close() {
+    if (map == nullptr) {
+        return;
+    }
+    PoedShmHeader* h = header();
+    uint64_t seq = h->seq.load(std::memory_order_relaxed);
+    h->seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    h->closed = 1;
+    h->seq.store(seq + 2, std::memory_order_release);
+
+    munmap(map, map_size);
+    map = nullptr;
+    map_size = 0;
+    shm_unlink(name.c_str());
+}
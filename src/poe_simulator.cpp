@@ -15,30 +15,38 @@
  */
 
 #include "poe_simulator.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 
-double PoeSimProfile::generateRandomDouble(double min, double max) {
-    // Create a random number generator using random_device as a seed
-    random_device rd;    // Obtain a random number from hardware
-    mt19937 gen(rd());   // Seed the generator with the random device
-    uniform_real_distribution<> dis(min, max); // Define the range for double
+/* Seed of the simulation, the same seed replays the same port data */
+static atomic<uint32_t> sim_seed(mt19937::default_seed);
+static atomic<uint32_t> sim_streams(0);
 
-    return dis(gen); // Generate the random number within the specified range
+void PoeSimProfile::seed(uint32_t value) {
+    sim_seed = value;
+    sim_streams = 0;
 }
 
-int PoeSimProfile::generateRandomNumber(int min, int max) {
-    // Create a random number generator using random_device as a seed
-    random_device rd;  // Obtain a random number from hardware
-    mt19937 gen(rd()); // Seed the generator with the random device
-    uniform_int_distribution<> dis(min, max); // Define the range
+/* Every thread gets its own engine seeded once from the common seed and the order of its first use,
+ * so the control loop and the fake sysfs threads never share the generator state
+ */
+mt19937& PoeSimProfile::generator() {
+    thread_local mt19937 gen = []() {
+        seed_seq seq{sim_seed.load(), sim_streams.fetch_add(1)};
+        return mt19937(seq);
+    }();
+    return gen;
+}
 
-    return dis(gen); // Generate the random number within the specified range
+double PoeSimProfile::generateRandomDouble(double min, double max) {
+    uniform_real_distribution<> dis(min, max);
+    return dis(generator());
 }
 
-string PoeSimProfile::to_string(double value, int precision) {
-    ostringstream out;
-    out.precision(precision);       // Set the desired precision
-    out << fixed << value;     // Use fixed-point notation
-    return out.str();
+int PoeSimProfile::generateRandomNumber(int min, int max) {
+    uniform_int_distribution<> dis(min, max);
+    return dis(generator());
 }
 
 PoeSimProfile::PoeSimProfile(int steps, double volt, double volt_var,
@@ -55,38 +63,36 @@ PoeSimProfile::PoeSimProfile(int steps, double volt, double volt_var,
     this->poe_class = std::move(poe_class);
     this->current_step = 0;
     this->enabled = true;
-}
 
-string PoeSimProfile::getPortInfo() { //i.e.: "0 eth14 auto 0.0 0.000"
-    double v = 0.0;
-    double c = 0.0;
-    if (enabled) {
-        v = generateRandomDouble(voltage - volt_variation, voltage + volt_variation);
-        c = generateRandomDouble(current - curr_variation, current + curr_variation);
-        current += curr_increment;
-    } else {
-        v = 0.0;
-        c = 0.0;
+    /* The state is given as the driver prints it, i.e. "4(DET_OK)", the leading digit is the code */
+    char code = this->state.empty() ? '0' : this->state[0];
+    if (code < '0' || code > '0' + static_cast<int>(PoeState::DCN)) {
+        code = '0';
     }
-    string result = string("N ethX mode ") + to_string(v, 1) + string(" ") +
-            to_string(c, 3) + string(" \n");
-    return result;
-}
-
-string PoeSimProfile::getPortStatus() { //i.e.: "0 eth14 6(OPEN) 0(Unknown)"
-    string result = string("N ethX ") + state + string(" ") + poe_class + string(" \n");
-    return result;
+    this->state_code = static_cast<PoeState>(code - '0');
 }
 
-vector<string> PoeSimProfile::getData() {
-    vector<string> result;
+/* Take the next reading, false when the profile has run all its steps */
+bool PoeSimProfile::getSample(PoeSimSample& sample) {
     if (current_step >= steps_total) {
-        return result;
+        return false;
+    }
+    if (enabled) {
+        /* Keep the resolution of the driver output, 0.1 V and 1 mA */
+        double v = generateRandomDouble(voltage - volt_variation, voltage + volt_variation);
+        double c = generateRandomDouble(current - curr_variation, current + curr_variation);
+        sample.voltage = round(v * 10.0) / 10.0;
+        sample.current = max(round(c * 1000.0) / 1000.0, 0.0);
+        current += curr_increment;
+    } else {
+        sample.voltage = 0.0;
+        sample.current = 0.0;
     }
-    result.push_back(getPortInfo());
-    result.push_back(getPortStatus());
+    sample.state = state_code;
+    sample.state_str = &state;
+    sample.class_str = &poe_class;
     current_step++;
-    return result;
+    return true;
 }
 
 void PoeSimProfile::reset() {
@@ -106,29 +112,45 @@ void PoeSimProfile::turnOff() {
 PoePortSim::PoePortSim(vector<PoeSimProfile> profiles) {
     sim_profiles = std::move(profiles);
     curr_profile = 0;
+    loop = true;
+    enabled = true;
 }
 
 PoePortSim::PoePortSim() {
     curr_profile = 0;
+    loop = true;
+    enabled = true;
 }
 
 void PoePortSim::addProfile(const PoeSimProfile& profile) {
     sim_profiles.push_back(profile);
 }
 
-vector<string> PoePortSim::getData() {
+/* Without the loop the last profile is repeated once all the profiles are over */
+void PoePortSim::setLoop(bool loop) {
+    this->loop = loop;
+}
+
+/* Take the next reading, switching to the next profile when the current one is over */
+bool PoePortSim::getSample(PoeSimSample& sample) {
     if (sim_profiles.empty()) {
-        return vector<string>{};
+        return false;
     }
-    vector<string> result = sim_profiles.at(curr_profile).getData();
-    if (result.empty()) {
+    /* Every profile gets a chance once, so profiles without steps can't loop forever */
+    for (size_t i = 0; i <= sim_profiles.size(); i++) {
+        if (sim_profiles.at(curr_profile).getSample(sample)) {
+            return true;
+        }
+        if (!loop && curr_profile + 1 >= sim_profiles.size()) {
+            sim_profiles.at(curr_profile).reset();
+            continue;
+        }
         curr_profile++;
         if (curr_profile >= sim_profiles.size()) {
             reset();
         }
-        return getData();
     }
-    return result;
+    return false;
 }
 
 void PoePortSim::reset() {
@@ -139,31 +161,20 @@ void PoePortSim::reset() {
 }
 
 void PoePortSim::turnOff() {
+    enabled = false;
     for (auto& profile: sim_profiles) {
         profile.turnOff();
     }
 }
 
+/* Power on of a powered port keeps the playback, the PD only restarts after an off->on transition */
 void PoePortSim::turnOn() {
+    if (enabled) {
+        return;
+    }
+    enabled = true;
     for (auto& profile: sim_profiles) {
         profile.turnOn();
     }
     reset();
 }
-
-
-void PoeDataSim::addPortSim(const PoePortSim& port_sim) {
-    ports_data.push_back(port_sim);
-}
-
-vector<string> PoeDataSim::getData() {
-    string ports_info = string("# name mode voltage current\n");
-    string ports_status = string("# name det_st class\n");
-    for (auto& port_sim: ports_data) {
-        vector<string> port_data = port_sim.getData();
-        ports_info += port_data.at(0);
-        ports_status += port_data.at(1);
-    }
-    vector<string> result = {ports_info, ports_status};
-    return result;
-}
\ No newline at end of file
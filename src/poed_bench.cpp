@@ -0,0 +1,660 @@
+/*
+ * © 2024 Proxeet Limited
+ *
+ * The poed packet is licensed under the GNU Lesser General Public License version 3,
+ * published by the Free Software Foundation.
+ *
+ * You may use, distribute, and modify this code under the terms of the LGPLv3.
+ *
+ * The project is distributed WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU Lesser General Public License version 3 for more details.
+ *
+ * Author: Aleksey Vasilenko (a.vasilenko@proxeet.com)
+ */
+
+/* Benchmarks of the daemon hot paths, every result is printed as one JSON line to stdout */
+
+#include "utils.h"
+#include "logs.h"
+#include "clipp.h"
+#include "poe_controller.h"
+#include "main_utils.h"
+#include "stats.h"
+#include "poe_scenario.h"
+#include "poe_schema.h"
+#include "poe_checkpoint.h"
+#include "poe_events.h"
+#include "poe_shm.h"
+#include "poe_commands.h"
+#include "fake_sysfs.h"
+#include <nlohmann/json.hpp>
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <thread>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static int min_iterations = 100;
+static double min_time_s = 0.5;
+static string bench_filter;
+static PoeScenario bench_scenario;
+static bool bench_scenario_loaded = false;
+static bool bench_failed = false;
+
+static uint64_t nowNs() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* Print the result line, a failed check makes the run exit non-zero */
+static void printResult(const nlohmann::json& result) {
+    if (!result["ok"].get<bool>()) {
+        bench_failed = true;
+    }
+    cout << result.dump() << endl;
+}
+
+/* A benchmark which could not even set up fails the run too, instead of silently missing from the output */
+static void printSetupFailure(const string& name, size_t ports, const string& error) {
+    if (!bench_filter.empty() && name.find(bench_filter) == string::npos) {
+        return;
+    }
+    nlohmann::json result = {
+            {"bench", name},
+            {"ports", ports},
+            {"ok", false},
+            {"error", error}
+    };
+    printResult(result);
+}
+
+/* Run the function until both iterations and time minimums are reached, report the distribution */
+static void runBench(const string& name, size_t ports, const function<bool()>& func) {
+    if (!bench_filter.empty() && name.find(bench_filter) == string::npos) {
+        return;
+    }
+
+    vector<uint64_t> samples;
+    uint64_t bench_start = nowNs();
+    uint64_t min_time_ns = (uint64_t)(min_time_s * 1e9);
+    bool ok = true;
+    while (samples.size() < (size_t)min_iterations || nowNs() - bench_start < min_time_ns) {
+        uint64_t start = nowNs();
+        if (!func()) {
+            ok = false;
+            break;
+        }
+        samples.push_back(nowNs() - start);
+    }
+
+    nlohmann::json result = {
+            {"bench", name},
+            {"ports", ports},
+            {"ok", ok},
+            {"iterations", samples.size()}
+    };
+    if (!samples.empty()) {
+        uint64_t total = 0;
+        for (auto sample: samples) {
+            total += sample;
+        }
+        sort(samples.begin(), samples.end());
+        result["mean_ns"] = total / samples.size();
+        result["p50_ns"] = samples[samples.size() / 2];
+        result["p99_ns"] = samples[min(samples.size() - 1, samples.size() * 99 / 100)];
+        result["max_ns"] = samples.back();
+    }
+    printResult(result);
+}
+
+/* Synthetic controller with ports in test mode or fed by raw port_info/port_status text */
+static PoeController makeController(size_t ports, bool sim) {
+    PoeController c;
+    c.path = "/sys/bus/i2c/devices/bench-" + to_string(ports);
+    c.total_budget = ports * 8.0;
+    c.resizePorts(ports);
+
+    for (size_t i = 0; i < ports; i++) {
+        PoePort& p = c.ports[i];
+        p.name = "eth" + to_string(i);
+        p.test_mode = sim;
+        c.telemetry.budget[i] = 15.0;
+        c.telemetry.priority[i] = 1 + i % 4;
+        c.telemetry.mode[i] = (uint8_t)PoeMode::POE_AUTO;
+        c.telemetry.setFlag(i, POE_PORT_ENABLED, true);
+        if (sim && (!bench_scenario_loaded || !bench_scenario.apply(p, PoeMode::POE_AUTO))) {
+            p.initSim(PoeMode::POE_AUTO);
+        }
+    }
+
+    c.port_info_raw = "# name mode voltage current\n";
+    c.port_status_raw = "# name det_st class\n";
+    for (size_t i = 0; i < ports; i++) {
+        c.port_info_raw += to_string(i) + " eth" + to_string(i) + " auto 48.1 0.126\n";
+        c.port_status_raw += to_string(i) + " eth" + to_string(i) + " 4(DET_OK) 6(0)\n";
+    }
+    return c;
+}
+
+static void benchControlBudgets(size_t ports) {
+    vector<PoeController> controllers = {makeController(ports, true)};
+    runBench("control_budgets", ports, [&]() { return controlBudgets(controllers) == 0; });
+}
+
+static void benchParse(size_t ports) {
+    PoeController controller = makeController(ports, false);
+    runBench("parse_ports_data", ports, [&]() { return controller.parsePortsData(); });
+}
+
+static void benchJson(size_t ports) {
+    vector<PoeController> controllers = {makeController(ports, false)};
+    controllers[0].parsePortsData();
+    runBench("json_get_all_dump", ports, [&]() {
+        return !getJsonFromControllers(controllers).dump(4).empty();
+    });
+}
+
+static void benchRecord(size_t ports) {
+    PoeController controller = makeController(ports, false);
+    controller.parsePortsData();
+    vector<PoePortRecord> records(ports);
+    runBench("record_encode", ports, [&]() {
+        for (size_t i = 0; i < ports; i++) {
+            encodePortRecord(controller, i, records[i]);
+        }
+        return records[0].state == (uint8_t)PoeState::DET_OK;
+    });
+}
+
+static void benchCheckpoint(size_t ports) {
+    vector<PoeController> controllers = {makeController(ports, false)};
+    string path = "/tmp/poed_bench." + to_string(getpid()) + ".state";
+    PoeCheckpoint checkpoint;
+    if (!checkpoint.open(path, controllers)) {
+        printSetupFailure("checkpoint_save", ports, "failed to open the checkpoint " + path);
+        return;
+    }
+    size_t port = 0;
+    runBench("checkpoint_save", ports, [&]() {
+        PoePortsTelemetry& tm = controllers[0].telemetry;
+        tm.setFlag(port, POE_PORT_OVERBUDGET, !tm.hasFlag(port, POE_PORT_OVERBUDGET));
+        port = (port + 1) % ports;
+        return checkpoint.saveIfChanged(controllers, monotonicUs());
+    });
+    checkpoint.close();
+    unlink(path.c_str());
+}
+
+/* Kill -9 a writer in the middle of the checkpoint writes, the restart must always find a complete state.
+ * Every state the writer saves has the same flags on all the ports, so a mix means a torn write got through.
+ * The writer cycles through three states, so a slot never gets the same state it already holds
+ */
+static void benchCheckpointKill(size_t ports) {
+    string name = "checkpoint_kill";
+    if (!bench_filter.empty() && name.find(bench_filter) == string::npos) {
+        return;
+    }
+
+    static const uint8_t states[] = {POE_PORT_OVERBUDGET, POE_PORT_OVERBUDGET | POE_PORT_ENABLE_PERM,
+                                     POE_PORT_ENABLE_PERM};
+    string path = "/tmp/poed_bench." + to_string(getpid()) + ".state";
+    unlink(path.c_str());
+    mt19937 rng(ports);
+    size_t kills = 0;
+    size_t torn = 0;
+    size_t lost = 0;
+    uint64_t bench_start = nowNs();
+    while (kills < (size_t)min_iterations || nowNs() - bench_start < (uint64_t)(min_time_s * 1e9)) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            printSetupFailure(name, ports, "failed to fork the checkpoint writer");
+            unlink(path.c_str());
+            return;
+        }
+        if (pid == 0) {
+            vector<PoeController> controllers = {makeController(ports, false)};
+            PoeCheckpoint checkpoint;
+            if (!checkpoint.open(path, controllers)) {
+                _exit(1);
+            }
+            for (size_t state = 0;; state = (state + 1) % 3) {
+                for (size_t i = 0; i < ports; i++) {
+                    controllers[0].telemetry.setFlag(i, POE_PORT_CHECKPOINTED, false);
+                    controllers[0].telemetry.setFlag(i, states[state], true);
+                }
+                checkpoint.save(controllers);
+            }
+        }
+        usleep(uniform_int_distribution<int>(0, 2000)(rng));
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+        kills++;
+
+        vector<PoeController> controllers = {makeController(ports, false)};
+        if (!PoeCheckpoint::load(path, controllers)) {
+            lost++;
+            continue;
+        }
+        const vector<uint8_t>& flags = controllers[0].telemetry.flags;
+        for (size_t i = 1; i < ports; i++) {
+            if ((flags[i] & POE_PORT_CHECKPOINTED) != (flags[0] & POE_PORT_CHECKPOINTED)) {
+                torn++;
+                break;
+            }
+        }
+    }
+    unlink(path.c_str());
+
+    /* The very first kill may come before the file is created, later ones must always load */
+    nlohmann::json result = {
+            {"bench", name},
+            {"ports", ports},
+            {"ok", torn == 0 && lost <= 1},
+            {"iterations", kills},
+            {"torn", torn},
+            {"lost", lost}
+    };
+    printResult(result);
+}
+
+static void benchEventPush() {
+    static PoeEventJournal journal;
+    size_t port = 0;
+    runBench("event_push", 1, [&]() {
+        journal.push(PoeEventKind::SHED_PORT_BUDGET, 0, port, 16.0, 15.0, 100.0);
+        port = (port + 1) % 48;
+        return true;
+    });
+}
+
+/* Read the journal while the writer laps it. Every event carries its sequence in all the numbers,
+ * so a mismatch means a torn event got through the slot lock, and the sequences must only grow
+ */
+static void benchEventRace() {
+    string name = "event_race";
+    if (!bench_filter.empty() && name.find(bench_filter) == string::npos) {
+        return;
+    }
+
+    static PoeEventJournal journal;
+    atomic<bool> stop{false};
+    thread writer([&]() {
+        while (!stop.load(memory_order_relaxed)) {
+            double seq = journal.getLastSeq() + 1;
+            journal.push(PoeEventKind::RESTORE, 0, 0, seq, seq, seq);
+        }
+    });
+
+    vector<PoeEvent> events;
+    uint64_t since = 0;
+    size_t reads = 0;
+    size_t received = 0;
+    size_t torn = 0;
+    uint64_t dropped_total = 0;
+    uint64_t bench_start = nowNs();
+    while (reads < (size_t)min_iterations || nowNs() - bench_start < (uint64_t)(min_time_s * 1e9)) {
+        events.clear();
+        uint64_t dropped = 0;
+        uint64_t last = journal.read(since, events, dropped);
+        for (const PoeEvent& event: events) {
+            double seq = event.seq;
+            if (event.seq <= since || event.power != seq || event.budget != seq || event.total != seq) {
+                torn++;
+            }
+            since = event.seq;
+        }
+        since = max(since, last);
+        received += events.size();
+        dropped_total += dropped;
+        reads++;
+    }
+    stop = true;
+    writer.join();
+
+    nlohmann::json result = {
+            {"bench", name},
+            {"ports", 1},
+            {"ok", torn == 0},
+            {"iterations", reads},
+            {"received", received},
+            {"dropped", dropped_total},
+            {"torn", torn}
+    };
+    printResult(result);
+}
+
+/* Snapshot publication of the control loop and a copy of the reader */
+static void benchShm(size_t ports) {
+    vector<PoeController> controllers = {makeController(ports, false)};
+    controllers[0].parsePortsData();
+    string name = "/poed_bench." + to_string(getpid());
+    PoeShm shm;
+    PoedShmReader reader;
+    if (!shm.open(name, controllers) || !reader.open(name.c_str())) {
+        printSetupFailure("shm_publish", ports, "failed to open the shared memory " + name);
+        printSetupFailure("shm_read", ports, "failed to open the shared memory " + name);
+        shm.close();
+        return;
+    }
+    uint64_t cycle = 0;
+    runBench("shm_publish", ports, [&]() {
+        shm.publish(controllers, ++cycle);
+        return true;
+    });
+    PoedShmSnapshot snapshot;
+    runBench("shm_read", ports, [&]() {
+        return reader.read(snapshot) && snapshot.ports.size() == ports;
+    });
+    reader.close();
+    shm.close();
+}
+
+/* Read snapshots while the writer publishes them. Every snapshot carries its cycle in the power of all
+ * the ports and the budget of the controller, so a mismatch means a torn snapshot got through the seqlock
+ */
+static void benchShmRace(size_t ports) {
+    string name = "shm_race";
+    if (!bench_filter.empty() && name.find(bench_filter) == string::npos) {
+        return;
+    }
+
+    vector<PoeController> controllers = {makeController(ports, false)};
+    controllers[0].parsePortsData();
+    string shm_name = "/poed_bench." + to_string(getpid());
+    PoeShm shm;
+    PoedShmReader reader;
+    if (!shm.open(shm_name, controllers) || !reader.open(shm_name.c_str())) {
+        printSetupFailure(name, ports, "failed to open the shared memory " + shm_name);
+        shm.close();
+        return;
+    }
+    atomic<bool> stop{false};
+    thread writer([&]() {
+        PoeController& controller = controllers[0];
+        for (uint64_t cycle = 1; !stop.load(memory_order_relaxed); cycle++) {
+            controller.total_budget = cycle;
+            for (size_t i = 0; i < ports; i++) {
+                controller.telemetry.power[i] = cycle;
+            }
+            shm.publish(controllers, cycle);
+            /* Let the reader in between the snapshots, as the control loop sleeps between its cycles */
+            this_thread::yield();
+        }
+    });
+
+    PoedShmSnapshot snapshot;
+    size_t reads = 0;
+    size_t failed = 0;
+    size_t torn = 0;
+    uint64_t bench_start = nowNs();
+    while (reads < (size_t)min_iterations || nowNs() - bench_start < (uint64_t)(min_time_s * 1e9)) {
+        reads++;
+        if (!reader.read(snapshot)) {
+            failed++;
+            continue;
+        }
+        double cycle = snapshot.cycle;
+        if (snapshot.cycle == 0) {
+            continue;
+        }
+        if (snapshot.controllers[0].total_budget != cycle) {
+            torn++;
+            continue;
+        }
+        for (const PoePortRecord& record: snapshot.ports) {
+            if (record.power != cycle) {
+                torn++;
+                break;
+            }
+        }
+    }
+    stop = true;
+    writer.join();
+    reader.close();
+    shm.close();
+
+    nlohmann::json result = {
+            {"bench", name},
+            {"ports", ports},
+            {"ok", torn == 0},
+            {"iterations", reads},
+            {"failed", failed},
+            {"torn", torn}
+    };
+    printResult(result);
+}
+
+/* Two controllers on the fake driver tree, every read of the second one hangs for a minute. The healthy one must
+ * be enforced on every cycle, while the hung one misses its read deadline, is failed and only retried after its
+ * backoff. The hung read may cost a cycle the read deadline, never the minute
+ */
+static void benchControllerFault() {
+    string name = "controller_fault";
+    if (!bench_filter.empty() && name.find(bench_filter) == string::npos) {
+        return;
+    }
+    const uint64_t period_us = 20000;
+    const uint64_t run_us = 3000000;
+    const uint64_t hang_us = 60000000;
+
+    char root[] = "/tmp/poed_bench_fault.XXXXXX";
+    if (mkdtemp(root) == nullptr) {
+        printSetupFailure(name, 4, "failed to create the fake driver tree");
+        return;
+    }
+    /* The serving threads of the tree are detached and keep the options and controllers until the exit */
+    static FakeSysfsOptions options;
+    static vector<unique_ptr<FakeSysfsController>> fakes;
+    options.root = root;
+    options.controllers = 2;
+    options.ports = 4;
+    options.read_latency_us = hang_us;
+    options.fault_controller = 1;
+
+    vector<PoeController> controllers;
+    for (size_t c = 0; c < options.controllers; c++) {
+        fakes.emplace_back(new FakeSysfsController(options.root + "/controller" + to_string(c), c, options.ports,
+                                                   options));
+        if (!fakes.back()->create()) {
+            printSetupFailure(name, options.ports, "failed to create the fake controller " + fakes.back()->getPath());
+            return;
+        }
+        fakes.back()->start();
+        controllers.push_back(makeController(options.ports, false));
+        controllers.back().path = fakes.back()->getPath();
+    }
+
+    size_t cycles = 0;
+    uint64_t max_cycle_us = 0;
+    uint64_t run_start = monotonicUs();
+    while (monotonicUs() - run_start < run_us) {
+        uint64_t cycle_start = monotonicUs();
+        controlBudgets(controllers);
+        uint64_t cycle_us = monotonicUs() - cycle_start;
+        max_cycle_us = max(max_cycle_us, cycle_us);
+        cycles++;
+        if (cycle_us < period_us) {
+            usleep(period_us - cycle_us);
+        }
+    }
+
+    const char* files[] = {"port_info", "port_status", "port_power_on", "port_power_off", "port_mode"};
+    for (auto& controller: controllers) {
+        for (auto file: files) {
+            unlink((controller.path + "/" + file).c_str());
+        }
+        rmdir(controller.path.c_str());
+    }
+    rmdir(root);
+
+    /* The bound on the cycle is loose on purpose, it only tells the deadline from the hang */
+    const PoeController& healthy = controllers[0];
+    const PoeController& hung = controllers[1];
+    uint64_t healthy_reads = healthy.stats.phases[PHASE_READ].getCount();
+    nlohmann::json result = {
+            {"bench", name},
+            {"ports", options.ports},
+            {"ok", healthy_reads == cycles && healthy.stats.failed_reads.get() == 0 &&
+                   healthy.health == ControllerHealth::OK && hung.health == ControllerHealth::FAILED &&
+                   max_cycle_us < hang_us / 10},
+            {"iterations", cycles},
+            {"healthy_reads", healthy_reads},
+            {"hung_reads", hung.stats.failed_reads.get()},
+            {"max_cycle_us", max_cycle_us}
+    };
+    printResult(result);
+}
+
+/* Command from the submit to its result, the consumer applies the commands every millisecond as a fast control loop */
+static void benchCommands() {
+    vector<PoeController> controllers = {makeController(8, false)};
+    controllers[0].parsePortsData();
+    atomic<bool> stop{false};
+    thread consumer([&]() {
+        while (!stop.load(memory_order_relaxed)) {
+            usleep(1000);
+            poe_commands.apply(controllers);
+        }
+    });
+
+    PoeCommand command{};
+    command.kind = PoeCommandKind::SET_PRIORITY;
+    runBench("command_apply", 1, [&]() {
+        PoeCommandResult result;
+        command.value = (int)command.value % 8 + 1;
+        return poe_commands.submit(command, result);
+    });
+    stop = true;
+    consumer.join();
+}
+
+/* Cost of a log message for the control loop: a filtered out one and a queued one */
+static void benchLog() {
+    runBench("log_filtered", 1, [&]() {
+        POE_LOG(BUDGET, LOG_DEBUG, "Port %zu of controller %s has overbudget: %.2lf W, while %.2lf W is max\n",
+                (size_t)7, "/sys/bus/i2c/devices/0-0020", 16.5, 15.0);
+        return true;
+    });
+
+    poe_logger.setLevel(LOG_INFO);
+    poe_logger.start();
+    runBench("log_async", 1, [&]() {
+        POE_LOG(BUDGET, LOG_INFO, "Port %zu of controller %s has overbudget: %.2lf W, while %.2lf W is max\n",
+                (size_t)7, "/sys/bus/i2c/devices/0-0020", 16.5, 15.0);
+        return true;
+    });
+    poe_logger.stop();
+    poe_logger.setLevel(LOG_ERR);
+}
+
+static void benchSocket(size_t ports) {
+    static vector<PoeController> controllers;
+    controllers = {makeController(ports, false)};
+    controllers[0].parsePortsData();
+
+    string socket_path = "/tmp/poed_bench." + to_string(getpid()) + ".sock";
+    thread server(handleUnixSocketServer, socket_path, std::ref(controllers));
+    server.detach();
+
+    /* Wait for the server to listen */
+    for (int i = 0; i < 100 && access(socket_path.c_str(), F_OK) != 0; i++) {
+        usleep(10000);
+    }
+
+    nlohmann::json get_all = {{"msg_type", "request"}, {"data", "get_all"}};
+    string get_all_msg = get_all.dump();
+    runBench("socket_get_all", ports, [&]() {
+        return requestFromUnixSocket(socket_path, get_all_msg, 2000).compare(0, 1, "{") == 0;
+    });
+
+    nlohmann::json get_port = {{"msg_type", "request"}, {"data", "get_port"}, {"name", "eth0"},
+                               {"fields", {"power"}}};
+    string get_port_msg = get_port.dump();
+    runBench("socket_get_port", ports, [&]() {
+        return requestFromUnixSocket(socket_path, get_port_msg, 2000).compare(0, 1, "{") == 0;
+    });
+
+    /* Dashboard views in one round trip */
+    nlohmann::json batch = {{"msg_type", "request"}, {"data", "batch"}, {"requests", {
+            {{"data", "get_controller"}, {"controller", 0}, {"fields", {"total_power", "health"}}},
+            {{"data", "get_port"}, {"name", "eth0"}, {"fields", {"power"}}},
+            {{"data", "get_events"}}
+    }}};
+    string batch_msg = batch.dump();
+    runBench("socket_batch", ports, [&]() {
+        nlohmann::json j_response = nlohmann::json::parse(requestFromUnixSocket(socket_path, batch_msg, 2000),
+                                                          nullptr, false);
+        return !j_response.is_discarded() && j_response["data"].size() == 3;
+    });
+
+    unlink(socket_path.c_str());
+}
+
+int main(int argc, char *argv[]) {
+    vector<string> wrong;
+    bool show_help = false;
+    unsigned sim_seed = 1;
+    string scenario_path;
+
+    auto cli = (
+            clipp::option("-n", "--iterations") &
+            clipp::value("Minimum iterations of every benchmark (default 100)", min_iterations),
+            clipp::option("-T", "--min-time") &
+            clipp::value("Minimum time of every benchmark in seconds (default 0.5)", min_time_s),
+            clipp::option("-f", "--filter") &
+            clipp::value("Run only benchmarks which names contain the string", bench_filter),
+            clipp::option("-S", "--seed") &
+            clipp::value("Seed of the simulated ports data (default 1)", sim_seed),
+            clipp::option("--scenario") &
+            clipp::value("JSON file with load profiles of the simulated ports", scenario_path),
+            clipp::option("-h", "--help").set(show_help).doc("Show help information"),
+            clipp::any_other(wrong)
+    );
+
+    if (!clipp::parse(argc, argv, cli) || !wrong.empty() || show_help) {
+        cout << "Usage:\n" << clipp::make_man_page(cli, argv[0]) << '\n';
+        return show_help ? 0 : -1;
+    }
+
+    /* Keep syslog out of the measurements */
+    initialize_logging("poed_bench", LOG_ERR);
+    PoeSimProfile::seed(sim_seed);
+    if (!scenario_path.empty()) {
+        if (!bench_scenario.load(scenario_path)) {
+            cerr << "Can't load scenario " << scenario_path << endl;
+            return -1;
+        }
+        bench_scenario_loaded = true;
+    }
+
+    const size_t port_counts[] = {4, 16, 64, 256, 1000};
+    for (auto ports: port_counts) {
+        benchControlBudgets(ports);
+    }
+    for (auto ports: port_counts) {
+        benchParse(ports);
+    }
+    for (auto ports: port_counts) {
+        benchJson(ports);
+        benchRecord(ports);
+        benchCheckpoint(ports);
+        benchShm(ports);
+    }
+    benchCheckpointKill(64);
+    benchEventPush();
+    benchEventRace();
+    benchShmRace(64);
+    benchControllerFault();
+    benchCommands();
+    benchLog();
+    benchSocket(8);
+
+    return bench_failed ? 1 : 0;
+}
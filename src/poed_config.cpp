@@ -0,0 +1,265 @@
+/*
+ * © 2024 Proxeet Limited
+ *
+ * The poed packet is licensed under the GNU Lesser General Public License version 3,
+ * published by the Free Software Foundation.
+ *
+ * You may use, distribute, and modify this code under the terms of the LGPLv3.
+ *
+ * The project is distributed WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU Lesser General Public License version 3 for more details.
+ *
+ * Author: Aleksey Vasilenko (a.vasilenko@proxeet.com)
+ */
+
+#include "poed_config.h"
+#include "poe_controller.h"
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <syslog.h>
+
+/* Required option of the section, logs the missing one */
+static const string* getOption(const UciSection& section, const char* section_name, size_t section_ind,
+                               const char* option) {
+    auto it = section.options.find(option);
+    if (it == section.options.end()) {
+        syslog(LOG_ERR, "Missing option '%s' in %s section %zu\n", option, section_name, section_ind);
+        return nullptr;
+    }
+    return &it->second;
+}
+
+/* The whole value must be a number */
+static bool parseLong(const string& value, long& result) {
+    if (value.empty()) {
+        return false;
+    }
+    char* end = nullptr;
+    errno = 0;
+    result = strtol(value.c_str(), &end, 10);
+    return errno == 0 && *end == '\0';
+}
+
+static bool parseDouble(const string& value, double& result) {
+    if (value.empty()) {
+        return false;
+    }
+    char* end = nullptr;
+    errno = 0;
+    result = strtod(value.c_str(), &end);
+    return errno == 0 && *end == '\0' && std::isfinite(result);
+}
+
+static bool getLongOption(const UciSection& section, const char* section_name, size_t section_ind,
+                          const char* option, long min, long max, long& result) {
+    const string* value = getOption(section, section_name, section_ind, option);
+    if (value == nullptr) {
+        return false;
+    }
+    if (!parseLong(*value, result) || result < min || result > max) {
+        syslog(LOG_ERR, "Invalid option %s '%s' in %s section %zu\n", option, value->c_str(), section_name,
+               section_ind);
+        return false;
+    }
+    return true;
+}
+
+static bool getDoubleOption(const UciSection& section, const char* section_name, size_t section_ind,
+                            const char* option, double& result) {
+    const string* value = getOption(section, section_name, section_ind, option);
+    if (value == nullptr) {
+        return false;
+    }
+    if (!parseDouble(*value, result) || result < 0.0) {
+        syslog(LOG_ERR, "Invalid option %s '%s' in %s section %zu\n", option, value->c_str(), section_name,
+               section_ind);
+        return false;
+    }
+    return true;
+}
+
+bool PoedConfig::compileGeneral(const UciSection& section) {
+    const string* log_level_opt = getOption(section, "general", 0, "log_level");
+    const string* socket_enable_opt = getOption(section, "general", 0, "unix_socket_enable");
+    const string* socket_path_opt = getOption(section, "general", 0, "unix_socket_path");
+    if (log_level_opt == nullptr || socket_enable_opt == nullptr || socket_path_opt == nullptr) {
+        return false;
+    }
+    log_level = *log_level_opt;
+    unix_socket_enable = *socket_enable_opt == "1";
+    unix_socket_path = *socket_path_opt;
+
+    /* Metrics listener is optional */
+    metrics_http_port = 0;
+    long port = 0;
+    if (section.options.count("metrics_http_port") &&
+            !getLongOption(section, "general", 0, "metrics_http_port", 0, 65535, port)) {
+        return false;
+    }
+    metrics_http_port = (int)port;
+    return true;
+}
+
+/* Check the number of the ports the driver reports against the config */
+static bool checkControllerPorts(const ControllerConfig& controller) {
+    string portinfo_path = controller.path + string("/port_info");
+    syslog(LOG_DEBUG, "Check PoE controller path %s\n", controller.path.c_str());
+    string portinfo;
+    try {
+        portinfo = cat(portinfo_path);
+        syslog(LOG_DEBUG, "Port info: %s\n", portinfo.c_str());
+    } catch (const exception& e) {
+        syslog(LOG_ERR, "Path %s can not be opened\n", portinfo_path.c_str());
+        return false;
+    }
+
+    size_t cnt_lines = countLines(portinfo, '#');
+    if (cnt_lines != controller.ports_num) {
+        syslog(LOG_ERR, "Controller %s has wrong ports number, in config: %zu, in fact: %zu\n",
+               controller.path.c_str(), controller.ports_num, cnt_lines);
+        return false;
+    }
+    return true;
+}
+
+void PoedConfig::addController(const string& path, size_t ports_num, double total_budget, double hysteresis) {
+    ControllerConfig controller;
+    controller.path = path;
+    controller.ports_num = ports_num;
+    controller.total_budget = total_budget;
+    controller.hysteresis = hysteresis;
+    controller.ports.assign(ports_num, POED_CONFIG_NO_PORT);
+    controllers.push_back(std::move(controller));
+}
+
+/* Controllers must be added before, the port takes its slot in the controller */
+bool PoedConfig::addPort(const PortConfig& port) {
+    if (port.controller >= controllers.size()) {
+        syslog(LOG_ERR, "Port %s has wrong controller index %zu\n", port.name.c_str(), port.controller);
+        return false;
+    }
+    ControllerConfig& controller = controllers[port.controller];
+    if (port.index >= controller.ports_num) {
+        syslog(LOG_ERR, "Port %s has wrong index %zu in controller %zu\n", port.name.c_str(), port.index,
+               port.controller);
+        return false;
+    }
+    if (controller.ports[port.index] != POED_CONFIG_NO_PORT) {
+        syslog(LOG_ERR, "Port %s takes index %zu in controller %zu of port %s\n", port.name.c_str(), port.index,
+               port.controller, ports[controller.ports[port.index]].name.c_str());
+        return false;
+    }
+    if (!port.name.empty() && !port_names.emplace(port.name, ports.size()).second) {
+        syslog(LOG_WARNING, "Port name %s is used more than once, the socket finds the last one by name\n",
+               port.name.c_str());
+        port_names[port.name] = ports.size();
+    }
+    controller.ports[port.index] = ports.size();
+    ports.push_back(port);
+    return true;
+}
+
+void PoedConfig::clearTopology() {
+    controllers.clear();
+    ports.clear();
+    port_names.clear();
+}
+
+bool PoedConfig::compileControllers(const vector<UciSection>& sections, bool check_hw) {
+    if (sections.size() > POE_CONTROLLERS_MAX) {
+        syslog(LOG_ERR, "More than %d controller sections\n", POE_CONTROLLERS_MAX);
+        return false;
+    }
+    controllers.reserve(sections.size());
+    for (size_t i = 0; i < sections.size(); i++) {
+        const UciSection& section = sections[i];
+        const string* path = getOption(section, "controller", i, "path");
+        long ports_num;
+        double total_budget;
+        double hysteresis = POE_DEFAULT_HYSTERESIS;
+        if (path == nullptr ||
+                !getLongOption(section, "controller", i, "ports", 1, POE_CONTROLLER_PORTS_MAX, ports_num) ||
+                !getDoubleOption(section, "controller", i, "total_power_budget", total_budget)) {
+            return false;
+        }
+        /* Hysteresis is optional */
+        if (section.options.count("hysteresis") &&
+                !getDoubleOption(section, "controller", i, "hysteresis", hysteresis)) {
+            return false;
+        }
+        addController(*path, ports_num, total_budget, hysteresis);
+        if (check_hw && !checkControllerPorts(controllers.back())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool PoedConfig::compilePorts(const vector<UciSection>& sections) {
+    ports.reserve(sections.size());
+    port_names.reserve(sections.size());
+    for (size_t i = 0; i < sections.size(); i++) {
+        const UciSection& section = sections[i];
+        PortConfig port;
+        const string* name = getOption(section, "port", i, "name");
+        const string* mode = getOption(section, "port", i, "mode");
+        long controller;
+        long index;
+        long priority;
+        if (name == nullptr || mode == nullptr ||
+                !getLongOption(section, "port", i, "controller", 0, INT_MAX, controller) ||
+                !getLongOption(section, "port", i, "port_number", 0, INT_MAX, index) ||
+                !getLongOption(section, "port", i, "priority", 1, INT_MAX, priority) ||
+                !getDoubleOption(section, "port", i, "power_budget", port.budget)) {
+            return false;
+        }
+        if (section.options.count("hysteresis") &&
+                !getDoubleOption(section, "port", i, "hysteresis", port.hysteresis)) {
+            return false;
+        }
+        port.name = *name;
+        port.controller = controller;
+        port.index = index;
+        port.priority = (int)priority;
+        port.mode = parsePoeMode(*mode);
+        if (!addPort(port)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Compile and validate the imported config in one pass over its sections,
+ * check_hw also requires the hardware to be configured and checks the ports number of every controller
+ */
+bool PoedConfig::compile(const UciConfig& config, bool check_hw) {
+    static const vector<UciSection> no_sections;
+    const map<string, vector<UciSection>>& sections = config.getSections();
+    auto general = sections.find("general");
+    auto controllers_it = sections.find("controller");
+    auto ports_it = sections.find("port");
+
+    clearTopology();
+    if (general == sections.end() || general->second.size() != 1) {
+        syslog(LOG_ERR, "Config must have exactly one general section\n");
+        return false;
+    }
+    if (!compileGeneral(general->second[0])) {
+        return false;
+    }
+    if (!compileControllers(controllers_it != sections.end() ? controllers_it->second : no_sections, check_hw) ||
+            !compilePorts(ports_it != sections.end() ? ports_it->second : no_sections)) {
+        return false;
+    }
+    if (check_hw && (controllers.empty() || ports.empty())) {
+        syslog(LOG_ERR, "Config has no controller or port sections\n");
+        return false;
+    }
+
+    syslog(LOG_INFO, "Configuration is valid, %zu controllers, %zu ports\n", controllers.size(), ports.size());
+    return true;
+}
@@ -0,0 +1,102 @@
+/*
+ * © 2024 Proxeet Limited
+ *
+ * The poed packet is licensed under the GNU Lesser General Public License version 3,
+ * published by the Free Software Foundation.
+ *
+ * You may use, distribute, and modify this code under the terms of the LGPLv3.
+ *
+ * The project is distributed WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU Lesser General Public License version 3 for more details.
+ *
+ * Author: Aleksey Vasilenko (a.vasilenko@proxeet.com)
+ */
+
+/* Helper process that serves a fake PoE controllers tree for the daemon running without hardware */
+
+#include "clipp.h"
+#include "fake_sysfs.h"
+#include <csignal>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sys/stat.h>
+#include <unistd.h>
+
+int main(int argc, char *argv[]) {
+    vector<string> wrong;
+    bool show_help = false;
+    int controllers_num = 2;
+    int ports_num = 4;
+    int read_latency_us = 0;
+    string config_path;
+    FakeSysfsOptions options;
+    options.root = "/tmp/poed_fakesysfs";
+
+    auto cli = (
+            clipp::option("-r", "--root") &
+            clipp::value("Directory of the fake controllers tree (default /tmp/poed_fakesysfs)", options.root),
+            clipp::option("-c", "--controllers") &
+            clipp::value("Number of controllers (default 2)", controllers_num),
+            clipp::option("-p", "--ports") &
+            clipp::value("Number of ports per controller (default 4)", ports_num),
+            clipp::option("-l", "--read-latency") &
+            clipp::value("Delay of every port_info/port_status read in us (default 0)", read_latency_us),
+            clipp::option("-e", "--read-error-rate") &
+            clipp::value("Share of reads served truncated or corrupted, 0..1 (default 0)", options.read_error_rate),
+            clipp::option("-w", "--write-drop-rate") &
+            clipp::value("Share of power/mode writes ignored, 0..1 (default 0)", options.write_drop_rate),
+            clipp::option("-F", "--fault-controller") &
+            clipp::value("Index of the only controller with the read latency and faults (default all)",
+                         options.fault_controller),
+            clipp::option("-S", "--seed") &
+            clipp::value("Seed of the simulated port data and the fault injection (default 1)", options.seed),
+            clipp::option("-o", "--config") &
+            clipp::value("Write UCI config for the fake tree to the file instead of stdout", config_path),
+            clipp::option("-h", "--help").set(show_help).doc("Show help information"),
+            clipp::any_other(wrong)
+    );
+
+    if (!clipp::parse(argc, argv, cli) || !wrong.empty() || show_help ||
+        controllers_num <= 0 || ports_num <= 0 || read_latency_us < 0 ||
+        options.fault_controller < -1 || options.fault_controller >= controllers_num) {
+        cout << "Usage:\n" << clipp::make_man_page(cli, argv[0]) << '\n';
+        return show_help ? 0 : -1;
+    }
+    options.controllers = controllers_num;
+    options.ports = ports_num;
+    options.read_latency_us = read_latency_us;
+    PoeSimProfile::seed(options.seed);
+
+    /* Readers that have gone must not kill the helper */
+    signal(SIGPIPE, SIG_IGN);
+
+    mkdir(options.root.c_str(), 0755);
+    vector<unique_ptr<FakeSysfsController>> controllers;
+    vector<FakeSysfsController*> controller_ptrs;
+    for (size_t i = 0; i < options.controllers; i++) {
+        controllers.emplace_back(new FakeSysfsController(options.root + "/controller" + to_string(i), i,
+                                                         options.ports, options));
+        if (!controllers.back()->create()) {
+            cerr << "Can't create " << controllers.back()->getPath() << "\n";
+            return -1;
+        }
+        controller_ptrs.push_back(controllers.back().get());
+    }
+
+    string config = getFakeSysfsUciConfig(options, controller_ptrs);
+    if (config_path.empty()) {
+        cout << config << flush;
+    } else {
+        ofstream(config_path) << config;
+    }
+
+    for (auto& controller: controllers) {
+        controller->start();
+    }
+    for (;;) {
+        pause();
+    }
+}
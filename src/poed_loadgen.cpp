@@ -0,0 +1,117 @@
+/*
+ * © 2024 Proxeet Limited
+ *
+ * The poed packet is licensed under the GNU Lesser General Public License version 3,
+ * published by the Free Software Foundation.
+ *
+ * You may use, distribute, and modify this code under the terms of the LGPLv3.
+ *
+ * The project is distributed WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU Lesser General Public License version 3 for more details.
+ *
+ * Author: Aleksey Vasilenko (a.vasilenko@proxeet.com)
+ */
+
+/* Load generator for the daemon Unix socket API, prints the result as JSON to stdout */
+
+#include "utils.h"
+#include "clipp.h"
+#include "main_utils.h"
+#include <nlohmann/json.hpp>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+
+/* Convert "get_all,get_port:eth9" list into the request messages */
+static bool parseRequests(const string& requests, vector<string>& messages) {
+    istringstream stream(requests);
+    string request;
+    while (getline(stream, request, ',')) {
+        if (request.empty()) {
+            continue;
+        }
+        nlohmann::json msg = {{"msg_type", "request"}};
+        size_t colon = request.find(':');
+        string command = request.substr(0, colon);
+        msg["data"] = command;
+        if (colon != string::npos) {
+            if (command == "get_port") {
+                msg["name"] = request.substr(colon + 1);
+            } else if (command == "get_controller") {
+                /* Plain index only, the daemon takes controller numbers far below the limit */
+                string index = request.substr(colon + 1);
+                if (index.empty() || index.size() > 9 || index.find_first_not_of("0123456789") != string::npos) {
+                    return false;
+                }
+                msg["controller"] = strtoul(index.c_str(), nullptr, 10);
+            } else {
+                return false;
+            }
+        }
+        messages.push_back(msg.dump());
+    }
+    return !messages.empty();
+}
+
+int main(int argc, char *argv[]) {
+    vector<string> wrong;
+    bool show_help = false;
+    int connections = 1;
+    string requests = "get_all";
+    string raw_request;
+    SocketLoadOptions options;
+
+    auto cli = (
+            clipp::option("-s", "--socket") &
+            clipp::value("Unix socket path (default is taken from the running daemon)", options.socket_path),
+            clipp::option("-c", "--connections") &
+            clipp::value("Number of concurrent connections (default 1)", connections),
+            clipp::option("-d", "--duration") &
+            clipp::value("Test duration in seconds (default 10)", options.duration_s),
+            clipp::option("-r", "--rate") &
+            clipp::value("Requests per second per connection, 0 is closed loop (default 0)", options.rate),
+            clipp::option("-q", "--requests") &
+            clipp::value("Comma separated requests sent in turn, i.e. get_all,get_port:eth9,get_controller:0 "
+                         "(default get_all)", requests),
+            clipp::option("-m", "--message") &
+            clipp::value("Raw JSON message to send instead of '--requests'", raw_request),
+            clipp::option("-k", "--keep-alive").set(options.persistent).doc("Send all the requests of a client "
+                                                                            "over one connection"),
+            clipp::option("-t", "--timeout") &
+            clipp::value("Response timeout in ms (default 2000)", options.timeout_ms),
+            clipp::option("-h", "--help").set(show_help).doc("Show help information"),
+            clipp::any_other(wrong)
+    );
+
+    if (!clipp::parse(argc, argv, cli) || !wrong.empty() || show_help || connections <= 0) {
+        cout << "Usage:\n" << clipp::make_man_page(cli, argv[0]) << '\n';
+        return show_help ? 0 : -1;
+    }
+    options.connections = connections;
+
+    if (!raw_request.empty()) {
+        options.messages.push_back(raw_request);
+    } else if (!parseRequests(requests, options.messages)) {
+        cerr << "Wrong requests list: " << requests << "\n";
+        cout << "Usage:\n" << clipp::make_man_page(cli, argv[0]) << '\n';
+        return -1;
+    }
+
+    if (options.socket_path.empty()) {
+        options.socket_path = getPidFileSocketPath(POED_PID_FILE);
+    }
+    if (options.socket_path.empty()) {
+        options.socket_path = POED_DEFAULT_SOCKET_PATH;
+    }
+
+    SocketLoadResult result = runSocketLoad(options);
+    nlohmann::json j_result = getJsonFromSocketLoadResult(result);
+    j_result["connections"] = options.connections;
+    j_result["rate"] = options.rate;
+    j_result["keep_alive"] = options.persistent;
+    cout << j_result.dump(4) << endl;
+
+    return result.status_cnt[(int)SocketLoadStatus::OK] > 0 ? 0 : -1;
+}
@@ -0,0 +1,138 @@
+/*
+ * © 2024 Proxeet Limited
+ *
+ * The poed packet is licensed under the GNU Lesser General Public License version 3,
+ * published by the Free Software Foundation.
+ *
+ * You may use, distribute, and modify this code under the terms of the LGPLv3.
+ *
+ * The project is distributed WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU Lesser General Public License version 3 for more details.
+ *
+ * Author: Aleksey Vasilenko (a.vasilenko@proxeet.com)
+ */
+
+#include "stats.h"
+#include <cstdio>
+#include <ctime>
+#include <sys/resource.h>
+#include <unistd.h>
+
+DaemonStats poe_stats;
+
+uint64_t monotonicUs() {
+    struct timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint64_t threadCpuTimeUs() {
+    struct timespec ts{};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+bool getProcessUsage(uint64_t& rss_kb, uint64_t& user_us, uint64_t& system_us) {
+    struct rusage usage{};
+    if (getrusage(RUSAGE_SELF, &usage) < 0) {
+        return false;
+    }
+    user_us = (uint64_t)usage.ru_utime.tv_sec * 1000000 + usage.ru_utime.tv_usec;
+    system_us = (uint64_t)usage.ru_stime.tv_sec * 1000000 + usage.ru_stime.tv_usec;
+
+    /* Current resident set, ru_maxrss is only the peak one */
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm == nullptr) {
+        return false;
+    }
+    unsigned long size_pages = 0;
+    unsigned long rss_pages = 0;
+    int parsed = fscanf(statm, "%lu %lu", &size_pages, &rss_pages);
+    fclose(statm);
+    if (parsed != 2) {
+        return false;
+    }
+    rss_kb = (uint64_t)rss_pages * (sysconf(_SC_PAGESIZE) / 1024);
+    return true;
+}
+
+const char* cyclePhaseToString(CyclePhase phase) {
+    static const char* names[PHASE_COUNT] = {"read", "parse", "decide", "actuate"};
+    return phase < PHASE_COUNT ? names[phase] : "unknown";
+}
+
+LatencyHistogram::LatencyHistogram() {
+    for (auto& bucket: buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+}
+
+LatencyHistogram::LatencyHistogram(const LatencyHistogram& other) : count(other.count), max_us(other.max_us) {
+    for (size_t i = 0; i < LATENCY_HIST_BUCKETS; i++) {
+        buckets[i].store(other.buckets[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+}
+
+LatencyHistogram& LatencyHistogram::operator=(const LatencyHistogram& other) {
+    for (size_t i = 0; i < LATENCY_HIST_BUCKETS; i++) {
+        buckets[i].store(other.buckets[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+    count = other.count;
+    max_us = other.max_us;
+    return *this;
+}
+
+size_t LatencyHistogram::bucketIndex(uint64_t us) {
+    if (us < LATENCY_HIST_SUB_BUCKETS) {
+        return us;
+    }
+    size_t octave = 63 - __builtin_clzll(us);
+    size_t sub = (us >> (octave - 2)) & (LATENCY_HIST_SUB_BUCKETS - 1);
+    size_t index = (octave - 1) * LATENCY_HIST_SUB_BUCKETS + sub;
+    return index < LATENCY_HIST_BUCKETS ? index : LATENCY_HIST_BUCKETS - 1;
+}
+
+uint64_t LatencyHistogram::bucketUpperBound(size_t index) {
+    if (index < LATENCY_HIST_SUB_BUCKETS) {
+        return index;
+    }
+    size_t octave = index / LATENCY_HIST_SUB_BUCKETS + 1;
+    uint64_t sub = index % LATENCY_HIST_SUB_BUCKETS;
+    uint64_t lower = (LATENCY_HIST_SUB_BUCKETS + sub) << (octave - 2);
+    return lower + ((uint64_t)1 << (octave - 2)) - 1;
+}
+
+void LatencyHistogram::add(uint64_t us) {
+    buckets[bucketIndex(us)].fetch_add(1, std::memory_order_relaxed);
+    count.add();
+    /* Single writer, so plain compare is enough */
+    if (us > max_us.get()) {
+        max_us.set(us);
+    }
+}
+
+uint64_t LatencyHistogram::getPercentile(double percentile) const {
+    uint64_t total = 0;
+    for (const auto& bucket: buckets) {
+        total += bucket.load(std::memory_order_relaxed);
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t)(percentile / 100.0 * (double)total);
+    if (rank >= total) {
+        rank = total - 1;
+    }
+    uint64_t seen = 0;
+    for (size_t i = 0; i < LATENCY_HIST_BUCKETS; i++) {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if (seen > rank) {
+            uint64_t bound = bucketUpperBound(i);
+            return bound < getMax() ? bound : getMax();
+        }
+    }
+    return getMax();
+}
@@ -81,46 +81,6 @@ void UciConfig::dump() {
     }
 }
 
-/* Method to validate the presence of a section and its options,
-* size_t occurrences == 0 means minimum 1 occurrence
-*/
-bool UciConfig::validateSection(const std::string& sectionName, size_t occurrences,
-                     const std::vector<std::string>& requiredOptions) const {
-    auto it = sections.find(sectionName);
-
-    /* Check if the section is present */
-    if (it == sections.end()) {
-        if (occurrences == 0) {
-            syslog(LOG_ERR, "Section '%s' is required but not found", sectionName.c_str());
-            return false;
-        } else {
-            return true; // If occurrences > 0, absence of this section is not an error
-        }
-    }
-
-    /* Check the number of occurrences */
-    size_t section_count = it->second.size();
-    if (occurrences > 0 && section_count > occurrences) {
-        syslog(LOG_ERR, "Section '%s' has too many occurrences. Expected at most %zu, found %zu",
-               sectionName.c_str(), occurrences, section_count);
-        return false;
-    }
-
-    /* Check required options */
-    for (const auto& section : it->second) {
-        for (const auto& option : requiredOptions) {
-            auto option_iter = section.options.find(option);
-            if (option_iter == section.options.end() || option_iter->second.empty()) {
-                syslog(LOG_ERR, "Missing or empty option '%s' in section '%s'",
-                       option.c_str(), sectionName.c_str());
-                return false;
-            }
-        }
-    }
-
-    return true;
-}
-
 bool UciConfig::exists() {
     struct uci_context *local_ctx = uci_alloc_context();
     if (!local_ctx) {
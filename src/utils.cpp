@@ -20,7 +20,9 @@
 #include <string>
 #include <iostream>
 #include <sstream>
-#include <dirent.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/file.h>
 
 void create_default_config(const std::string& config_path) {
     std::ofstream config_file(config_path);
@@ -34,18 +36,21 @@ void create_default_config(const std::string& config_path) {
     config_file << "\toption log_level 'debug'                         # Log level: debug, info, notice, warning, err, crit, alert, emerg\n";
     config_file << "\toption unix_socket_enable '1'                    # Enable (1) or disable (0) the unix socket server\n";
     config_file << "\toption unix_socket_path '/var/run/poed.sock'     # Path to the Unix socket used for inter-process communication\n";
+    config_file << "\toption metrics_http_port '0'                     # Loopback HTTP port serving OpenMetrics on /metrics, 0 disables\n";
     config_file << "\n";
 
     config_file << "config controller\n";
     config_file << "\toption path '/sys/bus/i2c/devices/i2c-8/8-002c'  # Path to the PoE controller in /sys\n";
     config_file << "\toption ports '4'                                 # Number of ports on this controller\n";
     config_file << "\toption total_power_budget '120'                  # Total power budget for all ports (in watts)\n";
+    config_file << "\toption hysteresis '5'                            # Spare power needed to restore a shed port (in watts)\n";
     config_file << "\n";
 
     config_file << "config controller\n";
     config_file << "\toption path '/sys/bus/i2c/devices/i2c-8/8-000c'  # Path to the PoE controller in /sys\n";
     config_file << "\toption ports '4'                                 # Number of ports on this controller\n";
     config_file << "\toption total_power_budget '120'                  # Total power budget for all ports (in watts)\n";
+    config_file << "\toption hysteresis '5'                            # Spare power needed to restore a shed port (in watts)\n";
     config_file << "\n";
 
     config_file << "config port\n";
@@ -175,177 +180,89 @@ int countLines(const std::string& content, char comment_char) {
     return count;
 }
 
-/* Function to return the line at a specified index, ignoring lines that start with the comment character */
-std::string getLineByIndex(const std::string& content, int index, char commentChar) {
+/* Function to split content into lines, ignoring lines that start with the comment character */
+std::vector<std::string> getLines(const std::string& content, char commentChar) {
+    std::vector<std::string> lines;
     std::istringstream stream(content);
     std::string line;
-    int currentIndex = 0;
 
-    /* Iterate through each line in the content */
     while (std::getline(stream, line)) {
-        /* Find the first non-whitespace character */
         std::string::size_type start = line.find_first_not_of(" \t");
-
-        /* Skip lines that are empty or start with the comment character */
         if (start != std::string::npos && line[start] != commentChar) {
-            if (currentIndex == index) {
-                return line;
-            }
-            ++currentIndex;
+            lines.push_back(line);
         }
     }
 
-    /* If the specified index is out of range, return an empty string */
-    return "";
+    return lines;
 }
 
-/* Function to extract a substring by index from a space-separated string */
-std::string getSubstringByIndex(const std::string& input, int index) {
-    std::istringstream stream(input);
-    std::string token;
-    int currentIndex = 0;
-
-    /* Iterate through each token in the input string separated by spaces */
-    while (std::getline(stream, token, ' ')) {
-        /* Skip empty tokens caused by consecutive spaces */
-        if (token.empty()) {
+/* Function to find the end of the first JSON object or array in the buffer starting from the offset,
+ * returns the offset right after it or npos if the value is not complete yet
+ */
+size_t findJsonValueEnd(const std::string& buf, size_t start) {
+    int depth = 0;
+    bool in_string = false;
+    bool escaped = false;
+
+    for (size_t i = start; i < buf.size(); i++) {
+        char ch = buf[i];
+        if (in_string) {
+            if (escaped) {
+                escaped = false;
+            } else if (ch == '\\') {
+                escaped = true;
+            } else if (ch == '"') {
+                in_string = false;
+            }
             continue;
         }
 
-        /* Check if the current index matches the desired index */
-        if (currentIndex == index) {
-            return token;
+        if (ch == '"') {
+            in_string = true;
+        } else if (ch == '{' || ch == '[') {
+            depth++;
+        } else if (ch == '}' || ch == ']') {
+            if (--depth <= 0) {
+                return i + 1;
+            }
         }
-
-        ++currentIndex;
     }
 
-    /* Return an empty string if the index is out of range */
-    return "";
+    return std::string::npos;
 }
 
-bool validateUciConfig(const UciConfig& config) {
-    /* Validate the 'general' section */
-    std::vector<std::string> general_options = {
-            "log_level", "unix_socket_enable", "unix_socket_path"
-    };
-    if (!config.validateSection("general", 1, general_options)) {
-        return false;
-    }
-
-    /* Validate the 'controller' section */
-    std::vector<std::string> controller_options = {
-            "path", "ports", "total_power_budget"
-    };
-    if (!config.validateSection("controller", 0, controller_options)) {
-        return false;
-    }
-
-    /* Validate the 'port' section */
-    std::vector<std::string> port_options = {
-            "name", "controller", "port_number", "power_budget", "mode", "priority"
-    };
-    if (!config.validateSection("port", 0, port_options)) {
-        return false;
+/* Function to take the pidfile lock held for the whole process lifetime,
+ * the socket path is stored on the second line for the clients,
+ * returns the locked file descriptor or -1 with errno set (EWOULDBLOCK if another instance holds it)
+ */
+int lockPidFile(const std::string& path, const std::string& socket_path) {
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return -1;
     }
 
-    /* Check poe controller ports number */
-    auto sections = config.getSections();
-    for (auto controller: sections["controller"]) {
-        string controller_path = controller.options["path"];
-        string portinfo_path = controller_path + string("/port_info");
-
-        /* Get port info */
-        syslog(LOG_DEBUG, "Check PoE controller paths...\n");
-        string portinfo;
-        try {
-            portinfo = cat(portinfo_path);
-            syslog(LOG_DEBUG, "Port info: %s\n", portinfo.c_str());
-        } catch (const exception& e) {
-            syslog(LOG_ERR, "Path %s can not be opened\n", portinfo_path.c_str());
-            return false;
-        }
-
-        int cnt_lines = countLines(portinfo, '#');
-        int cnt_lines_cfg = stoi(controller.options["ports"]);
-        if (cnt_lines != cnt_lines_cfg) {
-            syslog(LOG_ERR, "Controller %s has wrong ports number, in config: %d, in fact: %d\n",
-                   controller_path.c_str(), cnt_lines_cfg, cnt_lines);
-            return false;
-        }
+    if (flock(fd, LOCK_EX | LOCK_NB) < 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
     }
 
-    /* Check ports-to-controller correspondence */
-    auto ports = sections["port"];
-    auto controllers = sections["controller"];
-    int cnt = 0;
-    for (auto port: ports) {
-        /* Get controller index corresponded to port */
-        uint8_t controller_ind = stoi(port.options["controller"]);
-        uint8_t port_ind = stoi(port.options["port_number"]);
-
-        if (controller_ind >= controllers.size()) {
-            syslog(LOG_ERR, "Port %d has wrong controller index\n", cnt);
-            return false;
-        }
-
-        uint8_t controller_ports = stoi(controllers.at(controller_ind).options["ports"]);
-        if (port_ind >= controller_ports) {
-            syslog(LOG_ERR, "Port %d has wrong index in controller %d\n", cnt, controller_ind);
-            return false;
-        }
-
-        cnt++;
+    /* Store own pid for the tools that expect it in the pidfile */
+    string pid_str = to_string(getpid()) + "\n" + socket_path + "\n";
+    if (ftruncate(fd, 0) < 0 || write(fd, pid_str.c_str(), pid_str.size()) < 0) {
+        syslog(LOG_WARNING, "Can't write pid to %s\n", path.c_str());
     }
 
-    /* Configuration is valid */
-    syslog(LOG_INFO, "Configuration is valid");
-    return true;
+    return fd;
 }
 
-vector<pid_t> getProcessIdsByName(const std::string& processName) {
-    vector<pid_t> processIds;
-    DIR* dir = opendir("/proc");
-    if (dir) {
-        struct dirent* entry;
-        while ((entry = readdir(dir)) != nullptr) {
-            string d_name = entry->d_name;
-            pid_t pid = 0;
-            try {
-                pid = stoi(d_name);
-                if (pid > 0) {
-                    ifstream cmdline("/proc/" + to_string(pid) + "/comm");
-                    if (cmdline.is_open()) {
-                        string name;
-                        if (getline(cmdline, name)) {
-                            if (!name.empty() && name.back() == '\n') {
-                                name.pop_back();
-                            }
-                            if (name == processName && pid != getpid()) {
-                                processIds.push_back(pid);
-                            }
-                        }
-                    }
-                }
-            } catch (const invalid_argument& e) {
-                continue;
-            } catch (const out_of_range& e) {
-                continue;
-            }
-        }
-        closedir(dir);
-    }
-    return processIds;
-}
-
-string getProcessName(pid_t pid) {
-    ifstream comm_file("/proc/" + to_string(pid) + "/comm");
-    if (comm_file.is_open()) {
-        string name;
-        getline(comm_file, name);
-        comm_file.close();
-        return name;
-    } else {
+/* Function to get the socket path published by the running daemon in its pidfile */
+std::string getPidFileSocketPath(const std::string& path) {
+    std::ifstream file(path);
+    std::string line;
+    if (!std::getline(file, line) || !std::getline(file, line)) {
         return "";
     }
-}
\ No newline at end of file
+    return line;
+}